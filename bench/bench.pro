@@ -0,0 +1,21 @@
+QT       += widgets concurrent
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = bench
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    main.cpp \
+    ../bracketindex.cpp \
+    ../highlighter.cpp \
+    ../lexer.cpp \
+    ../lsp.cpp
+
+HEADERS += \
+    ../bracketindex.h \
+    ../highlighter.h \
+    ../lexer.h \
+    ../lsp.h
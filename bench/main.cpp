@@ -0,0 +1,411 @@
+/* Copyright (c) 2021, sarutora
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <random>
+#include <unistd.h>
+
+#include "highlighter.h"
+#include "lexer.h"
+#include "lsp.h"
+
+static quint64 allocations = 0;
+
+void *operator new(std::size_t size)
+{
+    allocations++;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+static double megabytesPerSecond(qint64 bytes, qint64 ns)
+{
+    return bytes / 1048576.0 / (ns / 1e9);
+}
+
+static QByteArray diagnosticsBody(int file, int count)
+{
+    QJsonArray diagnostics;
+    for (int i = 0; i < count; i++) {
+        QJsonObject range{{"start", QJsonObject{{"line", i}, {"character", 4}}},
+                          {"end", QJsonObject{{"line", i}, {"character", 12}}}};
+        diagnostics.append(QJsonObject{{"range", range}, {"severity", 2}, {"source", "rustc"},
+                                       {"message", QString("unused variable: `größe_%1` — prefix it with an underscore").arg(i)}});
+    }
+    QJsonObject params{{"uri", QString("file:///src/module_%1.rs").arg(file)}, {"version", file},
+                       {"diagnostics", diagnostics}};
+    QJsonObject message{{"jsonrpc", "2.0"}, {"method", "textDocument/publishDiagnostics"}, {"params", params}};
+    return QJsonDocument(message).toJson(QJsonDocument::Compact);
+}
+
+// Small messages with a large publishDiagnostics every eighth one; the
+// messages carry non-ASCII text so byte and character counts differ.
+static QByteArray messageStream(int megabytes, int &count)
+{
+    QByteArray stream;
+    count = 0;
+    while (stream.size() < megabytes * 1048576) {
+        QByteArray body = diagnosticsBody(count, count % 8 == 0 ? 2000 : 2);
+        stream += "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n" + body;
+        count++;
+    }
+    return stream;
+}
+
+// Feeds the stream to a Framer in reads of random size, the way the pipe
+// hands it over, and checks that every frame comes out whole.
+static void benchFraming()
+{
+    int expected;
+    QByteArray stream = messageStream(16, expected);
+    std::printf("framing: %d messages, %.1f MB\n", expected, stream.size() / 1048576.0);
+    const int limits[] = {16, 4096, 65536};
+    for (int limit: limits) {
+        std::mt19937 random(1);
+        std::uniform_int_distribution<int> split(1, limit);
+        Framer framer;
+        QByteArray message;
+        int messages = 0;
+        QElapsedTimer clock;
+        clock.start();
+        for (int offset = 0; offset < stream.size();) {
+            int size = qMin(split(random), stream.size() - offset);
+            memcpy(framer.reserve(size), stream.constData() + offset, size);
+            framer.commit(size);
+            offset += size;
+            while (framer.next(message)) {
+                if (message.isEmpty() || message.at(0) != '{' || message.at(message.size() - 1) != '}')
+                    throw "Broken frame";
+                messages++;
+            }
+        }
+        qint64 ns = clock.nsecsElapsed();
+        if (messages != expected)
+            throw "Lost frames";
+        std::printf("  reads of 1-%d bytes: %.0f MB/s\n", limit, megabytesPerSecond(stream.size(), ns));
+    }
+
+    Framer framer;
+    QByteArray message;
+    QElapsedTimer clock;
+    clock.start();
+    for (int offset = 0; offset < stream.size();) {
+        int size = qMin(65536, stream.size() - offset);
+        memcpy(framer.reserve(size), stream.constData() + offset, size);
+        framer.commit(size);
+        offset += size;
+        while (framer.next(message)) {
+            Message parsed = Message::fromJson(QJsonDocument::fromJson(message).object());
+            if (parsed.method.isEmpty())
+                throw "Broken message";
+        }
+    }
+    std::printf("  framed and parsed: %.0f MB/s\n", megabytesPerSecond(stream.size(), clock.nsecsElapsed()));
+}
+
+// One keystroke's didChange, built the way sendRequest used to build it and
+// through the JsonWriter template that replaced it.
+static void benchJson()
+{
+    const int count = 200000;
+    QString uri = "file:///home/user/project/src/main.rs";
+    ContentChange change{false, 120, 16, 120, 16, "x"};
+    qint64 bytes = 0;
+    std::printf("didChange, %d messages\n", count);
+
+    quint64 before = allocations;
+    QElapsedTimer clock;
+    clock.start();
+    for (int i = 0; i < count; i++) {
+        QJsonObject start{{"line", change.startLine}, {"character", change.startCharacter}};
+        QJsonObject end{{"line", change.endLine}, {"character", change.endCharacter}};
+        QJsonObject contentChange{{"range", QJsonObject{{"start", start}, {"end", end}}}, {"text", change.text}};
+        QJsonObject params{{"textDocument", QJsonObject{{"uri", uri}, {"version", i}}},
+                           {"contentChanges", QJsonArray{contentChange}}};
+        QJsonObject request{{"jsonrpc", "2.0"}, {"method", "textDocument/didChange"}, {"params", params}};
+        QByteArray content = QJsonDocument(request).toJson(QJsonDocument::Compact);
+        QString header = "Content-Length: " + QString::number(content.size()) + "\r\n\r\n";
+        QByteArray frame = header.toUtf8();
+        frame.append(content);
+        bytes += frame.size();
+    }
+    qint64 ns = clock.nsecsElapsed();
+    std::printf("  QJsonDocument: %.0f ns, %.1f allocations per message\n",
+                double(ns) / count, double(allocations - before) / count);
+
+    JsonWriter writer;
+    before = allocations;
+    clock.start();
+    for (int i = 0; i < count; i++) {
+        writer.clear();
+        writer.raw("{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didChange\",\"params\":{\"textDocument\":{\"uri\":");
+        writer.string(uri);
+        writer.raw(",\"version\":");
+        writer.number(i);
+        writer.raw("},\"contentChanges\":[{\"range\":{\"start\":");
+        writer.position(change.startLine, change.startCharacter);
+        writer.raw(",\"end\":");
+        writer.position(change.endLine, change.endCharacter);
+        writer.raw("},\"text\":");
+        writer.string(change.text);
+        writer.raw("}]}}");
+        bytes -= writer.frame().size();
+    }
+    ns = clock.nsecsElapsed();
+    std::printf("  JsonWriter: %.0f ns, %.1f allocations per message\n",
+                double(ns) / count, double(allocations - before) / count);
+    if (bytes != 0)
+        throw "Frames differ in size";
+}
+
+static QString rustSource(int lines)
+{
+    static const char *const templates[] = {
+        "/// Returns entry %1, or `None` when the table is empty.",
+        "pub fn entry_%1<'a>(table: &'a mut Vec<u64>, key: usize) -> Option<&'a u64> {",
+        "    let name = \"entry %1 \\\"quoted\\\" \\n\";",
+        "    let raw = r#\"raw %1 with \"quotes\" inside\"#;",
+        "    /* nested /* block %1 */ comment */",
+        "    if key > %1_usize && table.len() != 0 { return table.get(key % 16); }",
+        "    #[allow(unused)] let c = b'x'; let f = 1.5e3_f64 * %1 as f64;",
+        "    println!(\"{} {:?}\", self::NAME, table[key..].iter().map(|x| x + 1).collect::<Vec<_>>());",
+        "}",
+        "",
+    };
+    const int count = sizeof(templates) / sizeof(templates[0]);
+    QString text;
+    for (int i = 0; i < lines; i++) {
+        text += QString(templates[i % count]).replace("%1", QString::number(i));
+        text += '\n';
+    }
+    text.chop(1);
+    return text;
+}
+
+// The rules of the regular expression highlighter the lexer replaced, each
+// run over every line.
+static QVector<QRegularExpression> regexRules()
+{
+    QStringList patterns;
+    const char *const keywords[] = {
+        "as", "async", "await", "break", "const", "continue", "crate", "dyn", "else", "enum",
+        "extern", "fn", "for", "if", "impl", "in", "let", "loop", "match", "mod", "pub", "ref",
+        "return", "static", "struct", "super", "trait", "type", "union", "unsafe", "use", "where",
+        "while", "bool", "char", "f32", "f64", "i8", "i16", "i32", "i64", "i128", "isize", "str",
+        "u8", "u16", "u32", "u64", "u128", "usize", "mut", "move", "Self", "Copy", "Clone", "Debug",
+        "String", "Vec", "self"
+    };
+    for (const char *keyword: keywords)
+        patterns << QString("\\b%1\\b").arg(keyword);
+    patterns << "\\|" << "\\=" << "\\+" << "\\-" << "\\<" << "\\>" << "\\!" << "\\&" << "\\&\\&"
+             << "\\*" << "\\&(?=[A-Za-z0-9_'])";
+    patterns << "\\b[0-9]*" << "\\b[0-9]\\.[0-9_]*" << "\\b[0-9]_[0-9_]*";
+    const char *const suffixes[] = {
+        "f32", "f64", "i8", "i16", "i32", "i64", "i128", "isize", "u8", "u16", "u32", "u64", "u128", "usize"
+    };
+    for (const char *suffix: suffixes)
+        patterns << QString("\\b[0-9]*_%1\\b").arg(suffix);
+    patterns << "\\b[A-Za-z0-9_]+\\!" << "\\b[A-Za-z0-9_]+(?=::.)" << "\\b[A-Za-z0-9_]+(?=\\()"
+             << "(?<=struct)\\s*[A-Za-z0-9_]+" << "(?<=trait)\\s*[A-Za-z0-9_]+"
+             << "(?<=enum)\\s*[A-Za-z0-9_]+" << "(?<=fn)\\s*[A-Za-z0-9_]+" << "::" << "'\\\\?.'"
+             << "//[^\n]*" << "#\\[[^\n]*" << "(?<!/)///(?!/)[^\n]*" << "//\\![^\n]*"
+             << "(?<!')\"(?!')" << "\\\\" << "'[A-Za-z0-9_]+(?!')";
+    QVector<QRegularExpression> rules;
+    for (const auto &pattern: patterns)
+        rules.append(QRegularExpression(pattern));
+    return rules;
+}
+
+static void benchLexer()
+{
+    const int lineCount = 50000;
+    QString text = rustSource(lineCount);
+    QStringList lines = text.split('\n');
+    std::printf("lexer: %d lines, %.1f MB\n", lineCount, text.size() * 2 / 1048576.0);
+
+    QVector<QRegularExpression> rules = regexRules();
+    qint64 matches = 0;
+    QElapsedTimer clock;
+    clock.start();
+    for (const auto &line: lines) {
+        for (const auto &rule: rules) {
+            QRegularExpressionMatchIterator it = rule.globalMatch(line);
+            while (it.hasNext()) {
+                it.next();
+                matches++;
+            }
+        }
+    }
+    std::printf("  %d regular expressions: %.0f ns per line\n", rules.size(), double(clock.nsecsElapsed()) / lineCount);
+
+    RustLexer lexer;
+    qint64 tokens = 0;
+    int state = -1;
+    clock.start();
+    for (const auto &line: lines) {
+        state = lexer.lex(line, state);
+        tokens += lexer.tokens.size();
+    }
+    std::printf("  RustLexer: %.0f ns per line\n", double(clock.nsecsElapsed()) / lineCount);
+
+    clock.start();
+    LexedDocument document = lexDocument(text);
+    std::printf("  lexDocument: %.0f ns per line\n", double(clock.nsecsElapsed()) / lineCount);
+    if (document.lines.size() != lineCount || document.tokens.size() != tokens || matches == 0)
+        throw "Lexing results differ";
+}
+
+static long residentKilobytes()
+{
+    QFile file("/proc/self/statm");
+    if (!file.open(QFile::ReadOnly))
+        return 0;
+    QList<QByteArray> fields = file.readAll().split(' ');
+    return fields.size() > 1 ? fields.at(1).toLong() * (sysconf(_SC_PAGESIZE) / 1024) : 0;
+}
+
+// Types into a highlighted 20k-line document, deleting each line's text
+// again once it is typed so the document keeps its size; memory should
+// stay flat. Bracket queries then run against the resulting index.
+static void benchBrackets()
+{
+    const int lineCount = 20000;
+    QTextDocument document;
+    Highlighter highlighter(&document);
+    QElapsedTimer clock;
+    clock.start();
+    document.setPlainText(rustSource(lineCount));
+    highlighter.highlightVisible(0, document.blockCount() - 1);
+    std::printf("brackets: %d lines highlighted in %.0f ms\n", lineCount, clock.nsecsElapsed() / 1e6);
+
+    const QString typed = "let total = (values[index] + offsets[{ index }]);";
+    const int keystrokes = 20000;
+    std::mt19937 random(2);
+    std::uniform_int_distribution<int> lines(0, lineCount - 1);
+    QTextCursor cursor(&document);
+    long before = residentKilobytes();
+    clock.start();
+    for (int i = 0; i < keystrokes; i++) {
+        int column = i % (typed.size() * 2);
+        if (column == 0) {
+            cursor = QTextCursor(document.findBlockByNumber(lines(random)));
+            cursor.movePosition(QTextCursor::EndOfBlock);
+        }
+        if (column < typed.size())
+            cursor.insertText(typed.at(column));
+        else
+            cursor.deletePreviousChar();
+        if (i % 100 == 0)
+            QCoreApplication::processEvents();
+    }
+    qint64 ns = clock.nsecsElapsed();
+    highlighter.highlightVisible(0, document.blockCount() - 1);
+    std::printf("  typing: %.1f us per keystroke, resident memory %+ld kB over %d keystrokes\n",
+                ns / 1e3 / keystrokes, residentKilobytes() - before, keystrokes);
+
+    QVector<TextBlockData *> blocks;
+    int brackets = 0;
+    for (QTextBlock block = document.begin(); block.isValid(); block = block.next()) {
+        TextBlockData *data = static_cast<TextBlockData *>(block.userData());
+        if (!data || data->brackets().isEmpty())
+            continue;
+        blocks.append(data);
+        brackets += data->brackets().size();
+    }
+    std::printf("  %d brackets in %d bytes of BracketInfo\n", brackets, brackets * int(sizeof(BracketInfo)));
+
+    const int queries = 200000;
+    int found = 0;
+    clock.start();
+    for (int i = 0; i < queries; i++) {
+        TextBlockData *data = blocks.at(random() % blocks.size());
+        found += highlighter.bracketIndex.match(data, random() % data->brackets().size()) != -1;
+    }
+    std::printf("  match: %.0f ns per query\n", double(clock.nsecsElapsed()) / queries);
+    clock.start();
+    for (int i = 0; i < queries; i++) {
+        TextBlockData *data = blocks.at(random() % blocks.size());
+        found += highlighter.bracketIndex.enclosing(data, data->brackets().last().position + 1, '{') != -1;
+    }
+    std::printf("  enclosing: %.0f ns per query\n", double(clock.nsecsElapsed()) / queries);
+    if (found == 0)
+        throw "No brackets matched";
+}
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QGuiApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Microbenchmarks for Oxide's hot paths.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("benchmarks", "Any of framing, json, lexer, brackets; all of them when omitted.");
+    parser.process(app);
+
+    QStringList names = parser.positionalArguments();
+    try {
+        if (names.isEmpty() || names.contains("framing"))
+            benchFraming();
+        if (names.isEmpty() || names.contains("json"))
+            benchJson();
+        if (names.isEmpty() || names.contains("lexer"))
+            benchLexer();
+        if (names.isEmpty() || names.contains("brackets"))
+            benchBrackets();
+    } catch (const char *error) {
+        std::cerr << "bench: " << error << '\n';
+        return 1;
+    }
+    return 0;
+}
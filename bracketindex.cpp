@@ -0,0 +1,378 @@
+/* Copyright (c) 2021, sarutora
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "bracketindex.h"
+#include "highlighter.h"
+
+#include <climits>
+
+namespace {
+
+const BracketIndex::Summary empty = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+
+const BracketIndex::Summary &totalOf(const BracketIndex::Node *node)
+{
+    return node ? node->total : empty;
+}
+
+int sizeOf(const BracketIndex::Node *node)
+{
+    return node ? node->size : 0;
+}
+
+}
+
+int BracketIndex::pairOf(char c, bool *open)
+{
+    static const char brackets[] = "()[]{}";
+    for (int i = 0; i < 6; i++) {
+        if (brackets[i] == c) {
+            if (open)
+                *open = i % 2 == 0;
+            return i / 2;
+        }
+    }
+    return -1;
+}
+
+BracketIndex::~BracketIndex()
+{
+    destroy(root);
+}
+
+// Blocks outlive the index when the document is torn down, so their
+// pointers into it are cleared here.
+void BracketIndex::destroy(Node *node)
+{
+    if (!node)
+        return;
+    destroy(node->left);
+    destroy(node->right);
+    node->data->index = nullptr;
+    node->data->node = nullptr;
+    delete node;
+}
+
+void BracketIndex::pull(Node *node)
+{
+    const Summary &a = totalOf(node->left);
+    const Summary &x = node->self;
+    const Summary &b = totalOf(node->right);
+    for (int p = 0; p < pairCount; p++) {
+        node->total.sum[p] = a.sum[p] + x.sum[p] + b.sum[p];
+        node->total.min[p] = qMin(a.min[p], qMin(a.sum[p] + x.min[p], a.sum[p] + x.sum[p] + b.min[p]));
+        node->total.maxSuffix[p] = qMax(b.maxSuffix[p], qMax(b.sum[p] + x.maxSuffix[p], b.sum[p] + x.sum[p] + a.maxSuffix[p]));
+        node->total.count[p] = a.count[p] + x.count[p] + b.count[p];
+    }
+    node->size = sizeOf(node->left) + 1 + sizeOf(node->right);
+    if (node->left)
+        node->left->parent = node;
+    if (node->right)
+        node->right->parent = node;
+}
+
+BracketIndex::Node *BracketIndex::merge(Node *a, Node *b)
+{
+    if (!a || !b)
+        return a ? a : b;
+    if (a->priority > b->priority) {
+        a->right = merge(a->right, b);
+        pull(a);
+        return a;
+    }
+    b->left = merge(a, b->left);
+    pull(b);
+    return b;
+}
+
+void BracketIndex::split(Node *node, int count, Node *&a, Node *&b)
+{
+    if (!node) {
+        a = b = nullptr;
+        return;
+    }
+    if (sizeOf(node->left) < count) {
+        split(node->right, count - sizeOf(node->left) - 1, node->right, b);
+        a = node;
+        pull(a);
+    } else {
+        split(node->left, count, a, node->left);
+        b = node;
+        pull(b);
+    }
+}
+
+int BracketIndex::rank(const Node *node) const
+{
+    int r = sizeOf(node->left);
+    for (; node->parent; node = node->parent) {
+        if (node->parent->right == node)
+            r += sizeOf(node->parent->left) + 1;
+    }
+    return r;
+}
+
+// Nodes are in document order, so the new block's place is found by
+// comparing block numbers on the way down instead of walking the document
+// back to the closest block that already has a node.
+BracketIndex::Node *BracketIndex::insert(const QTextBlock &block, TextBlockData *data)
+{
+    int number = block.blockNumber();
+    int before = 0;
+    for (const Node *node = root; node;) {
+        if (node->block.blockNumber() < number) {
+            before += sizeOf(node->left) + 1;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    Node *node = new Node;
+    node->left = node->right = node->parent = nullptr;
+    node->priority = seed;
+    node->data = data;
+    node->block = block;
+    node->self = empty;
+    pull(node);
+    Node *a;
+    Node *b;
+    split(root, before, a, b);
+    root = merge(merge(a, node), b);
+    root->parent = nullptr;
+    return node;
+}
+
+void BracketIndex::remove(Node *node)
+{
+    Node *a;
+    Node *rest;
+    Node *middle;
+    Node *b;
+    split(root, rank(node), a, rest);
+    split(rest, 1, middle, b);
+    delete middle;
+    root = merge(a, b);
+    if (root)
+        root->parent = nullptr;
+}
+
+void BracketIndex::update(Node *node, const QTextBlock &block)
+{
+    node->block = block;
+    node->self = empty;
+    const QVector<BracketInfo> &brackets = node->data->brackets();
+    int depth[pairCount] = {0, 0, 0};
+    for (const auto &info: brackets) {
+        bool open;
+        int p = pairOf(info.character, &open);
+        if (p < 0)
+            continue;
+        depth[p] += open ? 1 : -1;
+        node->self.min[p] = qMin(node->self.min[p], depth[p]);
+        node->self.count[p]++;
+    }
+    int suffix[pairCount] = {0, 0, 0};
+    for (int i = brackets.size() - 1; i >= 0; i--) {
+        bool open;
+        int p = pairOf(brackets.at(i).character, &open);
+        if (p < 0)
+            continue;
+        suffix[p] += open ? 1 : -1;
+        node->self.maxSuffix[p] = qMax(node->self.maxSuffix[p], suffix[p]);
+    }
+    for (int p = 0; p < pairCount; p++)
+        node->self.sum[p] = depth[p];
+    for (; node; node = node->parent)
+        pull(node);
+}
+
+// Finds the first block after `from` in which `depth` unmatched opening
+// brackets get closed, leaving `depth` as it stands on entering that block.
+const BracketIndex::Node *BracketIndex::forward(const Node *from, int pair, int &depth) const
+{
+    auto descend = [&](const Node *node) -> const Node * {
+        while (true) {
+            if (node->left && depth + node->left->total.min[pair] < 0) {
+                node = node->left;
+                continue;
+            }
+            depth += totalOf(node->left).sum[pair];
+            if (depth + node->self.min[pair] < 0)
+                return node;
+            depth += node->self.sum[pair];
+            node = node->right;
+        }
+    };
+    if (from->right) {
+        if (depth + from->right->total.min[pair] < 0)
+            return descend(from->right);
+        depth += from->right->total.sum[pair];
+    }
+    for (const Node *node = from; node->parent; node = node->parent) {
+        const Node *parent = node->parent;
+        if (parent->left != node)
+            continue;
+        if (depth + parent->self.min[pair] < 0)
+            return parent;
+        depth += parent->self.sum[pair];
+        if (parent->right) {
+            if (depth + parent->right->total.min[pair] < 0)
+                return descend(parent->right);
+            depth += parent->right->total.sum[pair];
+        }
+    }
+    return nullptr;
+}
+
+const BracketIndex::Node *BracketIndex::backward(const Node *from, int pair, int &depth) const
+{
+    auto descend = [&](const Node *node) -> const Node * {
+        while (true) {
+            if (node->right && node->right->total.maxSuffix[pair] > depth) {
+                node = node->right;
+                continue;
+            }
+            depth -= totalOf(node->right).sum[pair];
+            if (node->self.maxSuffix[pair] > depth)
+                return node;
+            depth -= node->self.sum[pair];
+            node = node->left;
+        }
+    };
+    if (from->left) {
+        if (from->left->total.maxSuffix[pair] > depth)
+            return descend(from->left);
+        depth -= from->left->total.sum[pair];
+    }
+    for (const Node *node = from; node->parent; node = node->parent) {
+        const Node *parent = node->parent;
+        if (parent->right != node)
+            continue;
+        if (parent->self.maxSuffix[pair] > depth)
+            return parent;
+        depth -= parent->self.sum[pair];
+        if (parent->left) {
+            if (parent->left->total.maxSuffix[pair] > depth)
+                return descend(parent->left);
+            depth -= parent->left->total.sum[pair];
+        }
+    }
+    return nullptr;
+}
+
+int BracketIndex::scanForward(const Node *node, int from, int pair, int depth) const
+{
+    const QVector<BracketInfo> &brackets = node->data->brackets();
+    for (int i = from; i < brackets.size(); i++) {
+        bool open;
+        if (pairOf(brackets.at(i).character, &open) != pair)
+            continue;
+        if (open)
+            depth++;
+        else if (depth-- == 0)
+            return node->block.position() + brackets.at(i).position;
+    }
+    const Node *next = forward(node, pair, depth);
+    return next ? scanForward(next, 0, pair, depth) : -1;
+}
+
+int BracketIndex::scanBackward(const Node *node, int from, int pair, int depth) const
+{
+    const QVector<BracketInfo> &brackets = node->data->brackets();
+    for (int i = qMin(from, brackets.size() - 1); i >= 0; i--) {
+        bool open;
+        if (pairOf(brackets.at(i).character, &open) != pair)
+            continue;
+        if (!open)
+            depth++;
+        else if (depth-- == 0)
+            return node->block.position() + brackets.at(i).position;
+    }
+    const Node *previous = backward(node, pair, depth);
+    return previous ? scanBackward(previous, INT_MAX, pair, depth) : -1;
+}
+
+// Document position of the bracket matching brackets().at(index), or -1.
+int BracketIndex::match(TextBlockData *data, int index) const
+{
+    if (!data->node)
+        return -1;
+    bool open;
+    int pair = pairOf(data->brackets().at(index).character, &open);
+    if (pair < 0)
+        return -1;
+    return open ? scanForward(data->node, index + 1, pair, 0) : scanBackward(data->node, index - 1, pair, 0);
+}
+
+// Document position of the innermost unclosed `open` bracket before
+// `position` in the block, or -1.
+int BracketIndex::enclosing(TextBlockData *data, int position, char open) const
+{
+    int pair = pairOf(open);
+    if (!data->node || pair < 0)
+        return -1;
+    const QVector<BracketInfo> &brackets = data->brackets();
+    int index = 0;
+    while (index < brackets.size() && brackets.at(index).position < position)
+        index++;
+    return scanBackward(data->node, index - 1, pair, 0);
+}
+
+QTextBlock BracketIndex::previousWith(TextBlockData *data, char bracket) const
+{
+    int pair = pairOf(bracket);
+    const Node *node = data->node;
+    if (!node || pair < 0)
+        return QTextBlock();
+    auto last = [&](const Node *node) -> QTextBlock {
+        while (true) {
+            if (node->right && node->right->total.count[pair] > 0)
+                node = node->right;
+            else if (node->self.count[pair] > 0)
+                return node->block;
+            else
+                node = node->left;
+        }
+    };
+    if (node->self.count[pair] > 0)
+        return node->block;
+    if (node->left && node->left->total.count[pair] > 0)
+        return last(node->left);
+    for (; node->parent; node = node->parent) {
+        const Node *parent = node->parent;
+        if (parent->right != node)
+            continue;
+        if (parent->self.count[pair] > 0)
+            return parent->block;
+        if (parent->left && parent->left->total.count[pair] > 0)
+            return last(parent->left);
+    }
+    return QTextBlock();
+}
@@ -0,0 +1,95 @@
+/* Copyright (c) 2021, sarutora
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef BRACKETINDEX_H
+#define BRACKETINDEX_H
+
+#include <QTextBlock>
+
+class TextBlockData;
+
+// Keeps one node per highlighted block, in document order, in an implicit
+// treap. Every subtree knows, for each bracket pair, its net depth change,
+// its lowest prefix depth and its highest suffix depth, so the block that
+// closes or opens a given depth is found in O(log n) instead of by walking
+// the document.
+class BracketIndex
+{
+public:
+    enum { pairCount = 3 };
+
+    struct Summary
+    {
+        int sum[pairCount];
+        int min[pairCount];
+        int maxSuffix[pairCount];
+        int count[pairCount];
+    };
+
+    struct Node
+    {
+        Node *left;
+        Node *right;
+        Node *parent;
+        uint priority;
+        int size;
+        TextBlockData *data;
+        QTextBlock block;
+        Summary self;
+        Summary total;
+    };
+
+    BracketIndex() = default;
+    BracketIndex(const BracketIndex &) = delete;
+    ~BracketIndex();
+
+    Node *insert(const QTextBlock &block, TextBlockData *data);
+    void remove(Node *node);
+    void update(Node *node, const QTextBlock &block);
+
+    int match(TextBlockData *data, int index) const;
+    int enclosing(TextBlockData *data, int position, char open) const;
+    QTextBlock previousWith(TextBlockData *data, char bracket) const;
+
+    static int pairOf(char c, bool *open = nullptr);
+
+private:
+    int scanForward(const Node *node, int from, int pair, int depth) const;
+    int scanBackward(const Node *node, int from, int pair, int depth) const;
+    const Node *forward(const Node *from, int pair, int &depth) const;
+    const Node *backward(const Node *from, int pair, int &depth) const;
+    void pull(Node *node);
+    Node *merge(Node *a, Node *b);
+    void split(Node *node, int count, Node *&a, Node *&b);
+    int rank(const Node *node) const;
+    void destroy(Node *node);
+
+    Node *root = nullptr;
+    uint seed = 2463534242u;
+};
+
+#endif // BRACKETINDEX_H
@@ -25,6 +25,7 @@
 */
 
 #include <QtWidgets>
+#include <algorithm>
 
 #include "highlighter.h"
 #include "codeeditor.h"
@@ -40,15 +41,36 @@ CodeEditor::CodeEditor(QWidget *parent, Client *client) : QPlainTextEdit(parent)
     commentExpression = QRegularExpression(s);
     endExpression = QRegularExpression("[{};,]\\s*$");
     blankExpression = QRegularExpression("^[\\s]*$");
-    warningFormat.setFontUnderline(true);
-    warningFormat.setUnderlineColor(Qt::yellow);
-    warningFormat.setUnderlineStyle(QTextCharFormat::WaveUnderline);
-    errorFormat.setFontUnderline(true);
-    errorFormat.setUnderlineColor(Qt::red);
-    errorFormat.setUnderlineStyle(QTextCharFormat::WaveUnderline);
-    connect(rls->ls, SIGNAL(readyReadStandardOutput()), this, SLOT(processResponse()));
-    connect(rls->ls,static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, &CodeEditor::rebootRls);
-    rls->keep = true;
+    changeTimer = new QTimer(this);
+    changeTimer->setSingleShot(true);
+    changeTimer->setInterval(150);
+    connect(changeTimer, &QTimer::timeout, this, &CodeEditor::flushChanges);
+    semanticTimer = new QTimer(this);
+    semanticTimer->setSingleShot(true);
+    semanticTimer->setInterval(150);
+    connect(semanticTimer, &QTimer::timeout, this, &CodeEditor::requestVisibleTokens);
+    hoverTimer = new QTimer(this);
+    hoverTimer->setSingleShot(true);
+    hoverTimer->setInterval(250);
+    connect(hoverTimer, &QTimer::timeout, this, &CodeEditor::showTip);
+    visibleTimer = new QTimer(this);
+    visibleTimer->setSingleShot(true);
+    visibleTimer->setInterval(0);
+    connect(visibleTimer, &QTimer::timeout, this, &CodeEditor::highlightVisible);
+    connect(verticalScrollBar(), &QScrollBar::valueChanged, this, [this]() {
+        visibleTimer->start();
+        if (rls && !rls->capabilities.semanticTokensFull)
+            semanticTimer->start();
+    });
+
+    setupDecorations();
+    gutter.addLane([this](const QTextBlock &block) {
+        int severity = diagnostics.severityIn(block.position(), block.position() + block.length() - 1);
+        return severity == 0 ? QColor() : severity == 1 ? QColor(Qt::red) : QColor(Qt::yellow);
+    });
+    connect(document(), &QTextDocument::contentsChange, this, [this]() {
+        gutter.invalidate();
+    });
 
     connect(this, SIGNAL(blockCountChanged(int)), this, SLOT(updateLineNumberAreaWidth(int)));
     connect(this, SIGNAL(updateRequest(QRect,int)), this, SLOT(updateLineNumberArea(QRect,int)));
@@ -105,7 +127,7 @@ CodeEditor::CodeEditor(QWidget *parent, Client *client) : QPlainTextEdit(parent)
     ));
     c = new QCompleter(this);
     c->setModel(new QStringListModel(QStringList(), c));
-    c->setModelSorting(QCompleter::CaseInsensitivelySortedModel);
+    c->setModelSorting(QCompleter::UnsortedModel);
     c->setCaseSensitivity(Qt::CaseInsensitive);
     c->setWrapAround(false);
     setCompleter();
@@ -114,12 +136,9 @@ CodeEditor::CodeEditor(QWidget *parent, Client *client) : QPlainTextEdit(parent)
 CodeEditor::~CodeEditor()
 {
     if (rls) {
-        QJsonObject textDocumentIdentifier;
-        textDocumentIdentifier.insert("uri", uri);
-        QJsonObject params;
-        params.insert("textDocument", textDocumentIdentifier);
-        QJsonObject closeNotification = rls->createRequest("textDocument/didClose", params);
-        rls->sendRequest(closeNotification);
+        rls->dispatcher->detach(uri);
+        flushChanges();
+        rls->closeDocument(uri);
     }
 }
 
@@ -213,7 +232,10 @@ void CodeEditor::loadFile(const QString &fileName)
 #ifndef QT_NO_CURSOR
     QGuiApplication::setOverrideCursor(Qt::WaitCursor);
 #endif
-    setPlainText(in.readAll());
+    QString text = in.readAll();
+    setPlainText(text);
+    if (highlighter)
+        highlighter->lexInBackground(text);
 #ifndef QT_NO_CURSOR
     QGuiApplication::restoreOverrideCursor();
 #endif
@@ -241,102 +263,139 @@ bool CodeEditor::maybeSave()
     return true;
 }
 
-QJsonObject getPosition(QTextCursor tc) {
-    QJsonObject position;
-    int line = tc.blockNumber();
-    int character = tc.positionInBlock();
-    position.insert("line", line);
-    position.insert("character", character);
-    return position;
+void CodeEditor::getCompletion() {
+    if (!rls->capabilities.completion)
+        return;
+    int start = textCursor().position() - completionPrefix.length();
+    if (start == completionStart && !completionIncomplete && completionPrefix.startsWith(requestedPrefix)) {
+        filterCompletion();
+        return;
+    }
+    completionStart = start;
+    requestedPrefix = completionPrefix;
+    completions.setLabels(QStringList());
+    request("textDocument/completion", textCursor(), [this](const QJsonValue &result) {
+        showCompletion(result);
+    });
 }
 
-void CodeEditor::getCompletion() {
-    QTextCursor tc = textCursor();
-    QJsonObject params;
-    QJsonObject textDocument;
-    textDocument.insert("uri", uri);
-    params.insert("textDocument", textDocument);
-    params.insert("position", getPosition(tc));
-    QJsonObject hoverRequest = rls->createRequest("textDocument/completion", params);
-    rls->sendRequest(hoverRequest);
-}
-
-void CodeEditor::getTip(const QPoint &pos) {
-    QTextCursor tc = cursorForPosition(pos);
-    int bc = floor(log10(document()->blockCount()))+4;
-    tc.movePosition(QTextCursor::Left, QTextCursor::MoveAnchor, bc);
-    int p = tc.position();
-    for (const auto &diagnostic: diagnostics) {
-        if (p >= diagnostic.position && p < diagnostic.position + diagnostic.length) {
-            codeTip = diagnostic.message;
-            return;
-        }
+void CodeEditor::followSymbol()
+{
+    if (!rls->capabilities.definition)
+        return;
+    request("textDocument/definition", textCursor(), [this](const QJsonValue &result) {
+        showDefinition(result);
+    });
+}
+
+void CodeEditor::request(const QString &method, const QTextCursor &tc, Client::Callback callback)
+{
+    flushChanges();
+    int id = requests.value(method, -1);
+    if (id != -1)
+        rls->cancel(id);
+    requests.insert(method, rls->requestAt(method, uri, tc.blockNumber(), tc.positionInBlock(), this, callback));
+}
+
+// Hover replies are cached per identifier and document version, so
+// returning to a symbol shows its tip without asking the server again.
+QString CodeEditor::tipKey(const QTextCursor &tc) const
+{
+    QString text = tc.block().text();
+    int start = tc.positionInBlock();
+    int end = start;
+    while (start > 0 && (text.at(start - 1).isLetterOrNumber() || text.at(start - 1) == '_'))
+        start--;
+    while (end < text.size() && (text.at(end).isLetterOrNumber() || text.at(end) == '_'))
+        end++;
+    if (start == end)
+        return QString();
+    return QString("%1:%2:%3:%4-%5").arg(uri).arg(version).arg(tc.blockNumber()).arg(start).arg(end);
+}
+
+// Runs once the pointer has rested; the tip is shown when the reply comes
+// in, and only if the pointer is still over the same identifier.
+void CodeEditor::showTip()
+{
+    QTextCursor tc = cursorForPosition(hoverPos);
+    QPoint globalPos = viewport()->mapToGlobal(hoverPos);
+    if (const Diagnostic *diagnostic = diagnostics.at(tc.position())) {
+        QToolTip::showText(globalPos, diagnostic->message, this);
+        return;
     }
-    QJsonObject params;
-    QJsonObject textDocument;
-    textDocument.insert("uri", uri);
-    params.insert("textDocument", textDocument);
-    params.insert("position", getPosition(tc));
-    QJsonObject hoverRequest = rls->createRequest("textDocument/hover", params);
-    rls->sendRequest(hoverRequest);
+    if (!rls || !rls->capabilities.hover)
+        return;
+    flushChanges();
+    QString key = tipKey(tc);
+    if (key.isEmpty())
+        return;
+    auto cached = hoverCache.constFind(key);
+    if (cached != hoverCache.constEnd()) {
+        if (!cached->isEmpty())
+            QToolTip::showText(globalPos, *cached, this);
+        return;
+    }
+    int requested = version;
+    request("textDocument/hover", tc, [this, key, requested](const QJsonValue &result) {
+        showHover(key, requested, result);
+    });
+}
+
+void CodeEditor::mouseMoveEvent(QMouseEvent *e)
+{
+    if (rectangleLine != -1 && (e->buttons() & Qt::LeftButton)) {
+        if (cursorForPosition(e->pos()).blockNumber() != rectangleLine || columnAt(e->pos()) != rectangleColumn)
+            selectRectangle(e->pos());
+        return;
+    }
+    QPlainTextEdit::mouseMoveEvent(e);
+    if (e->buttons() != Qt::NoButton)
+        return;
+    if (QToolTip::isVisible() && tipKey(cursorForPosition(e->pos())) != tipKey(cursorForPosition(hoverPos)))
+        QToolTip::hideText();
+    hoverPos = e->pos();
+    hoverTimer->start();
+}
+
+void CodeEditor::leaveEvent(QEvent *e)
+{
+    hoverTimer->stop();
+    QPlainTextEdit::leaveEvent(e);
 }
 
 bool CodeEditor::event(QEvent *event)
 {
-    if (event->type() == QEvent::ToolTip) {
-        QHelpEvent *helpEvent = static_cast<QHelpEvent *>(event);
-        getTip(helpEvent->pos());
-        if (!codeTip.isEmpty()) {
-            QToolTip::showText(helpEvent->globalPos(), codeTip);
-        } else {
-            QToolTip::hideText();
-            event->ignore();
-        }
+    if (event->type() == QEvent::ToolTip)
         return true;
-    }
     return QPlainTextEdit::event(event);
 }
 
 void CodeEditor::matchBrackets()
 {
-
+    bracketSelections.clear();
     TextBlockData *data = static_cast<TextBlockData *>(textCursor().block().userData());
 
     if (data) {
-        QVector<BracketInfo *> infos = data->brackets();
+        const QVector<BracketInfo> &infos = data->brackets();
 
         int pos = textCursor().block().position();
-        for (const auto pair: data->pairs()) {
-            for (int i = 0; i < infos.size(); ++i) {
-                BracketInfo *info = infos.at(i);
-
-                int curPos = textCursor().position() - textCursor().block().position();
-                QColor c;
-                if (info->position == curPos - 1 && info->character == pair.first) {
-                    if (matchLeftBracket(textCursor().block(), i + 1, 0, pair)) {
-                        c = didMatch;
-                    } else {
-                        c = noMatch;
-                    }
-                    createBracketSelection(pos + info->position, c);
-                } else if (info->position == curPos - 1 && info->character == pair.second) {
-                    if (matchRightBracket(textCursor().block(), i - 1, 0, pair)) {
-                        c = didMatch;
-                    } else {
-                        c = noMatch;
-                    }
-                    createBracketSelection(pos + info->position, c);
-                }
-            }
+        int curPos = textCursor().position() - pos;
+        for (int i = 0; i < infos.size() && data->index; ++i) {
+            const BracketInfo &info = infos.at(i);
+            if (info.position != curPos - 1 || BracketIndex::pairOf(info.character) < 0)
+                continue;
+            int match = data->index->match(data, i);
+            if (match != -1)
+                createBracketSelection(match, didMatch);
+            createBracketSelection(pos + info.position, match != -1 ? didMatch : noMatch);
         }
         inString = false;
         for (int i = 0; i < infos.size(); ++i) {
-            BracketInfo *info = infos.at(i);
-            int curPos = textCursor().position() - textCursor().block().position();
-            if (info->position < curPos) {
-                if (info->character == '\'') {
+            const BracketInfo &info = infos.at(i);
+            if (info.position < curPos) {
+                if (info.character == '\'') {
                     inString = true;
-                } else if (info->character == '\"') {
+                } else if (info.character == '\"') {
                     inString = false;
                 }
             } else {
@@ -347,45 +406,44 @@ void CodeEditor::matchBrackets()
 }
 
 int findBracketIndent(QTextBlock block) {
-    while (block.isValid()) {
-        QString text = block.text();
-        TextBlockData *data = static_cast<TextBlockData *>(block.userData());
-        QVector<BracketInfo *> infos = data->brackets();
-        for (int i = 0; i < infos.size(); ++i) {
-            BracketInfo *info = infos.at(i);
-            if (info->character == '{') {
-                int n = 0;
-                static QString spaces = "    ";
-                int start = block.text().indexOf(spaces);
-                while (start != -1) {
-                    n++;
-                    start = block.text().indexOf(spaces, start + spaces.size());
-                }
-                return n;
-            }
-            if (info->character == '}') {
-                return -1;
+    TextBlockData *data = static_cast<TextBlockData *>(block.userData());
+    if (!data || !data->index)
+        return -1;
+    block = data->index->previousWith(data, '{');
+    if (!block.isValid())
+        return -1;
+    data = static_cast<TextBlockData *>(block.userData());
+    for (const auto &info: data->brackets()) {
+        if (info.character == '{') {
+            int n = 0;
+            static QString spaces = "    ";
+            int start = block.text().indexOf(spaces);
+            while (start != -1) {
+                n++;
+                start = block.text().indexOf(spaces, start + spaces.size());
             }
+            return n;
         }
-        block = block.previous();
+        if (info.character == '}')
+            return -1;
     }
     return -1;
 }
 
 int findIndent(QTextBlock currentBlock) {
     TextBlockData *data = static_cast<TextBlockData *>(currentBlock.userData());
-    QVector<BracketInfo *> infos = data->brackets();
+    const QVector<BracketInfo> &infos = data->brackets();
 
     int num = 0;
     for (int i = 0; i < infos.size(); ++i) {
-        BracketInfo *info = infos.at(i);
+        const BracketInfo &info = infos.at(i);
 
-        if (info->character == '{') {
+        if (info.character == '{') {
             ++num;
             continue;
         }
 
-        if (info->character == '}') {
+        if (info.character == '}') {
             if (num > 0)
                 --num;
         }
@@ -393,72 +451,21 @@ int findIndent(QTextBlock currentBlock) {
     return num;
 }
 
-bool CodeEditor::matchLeftBracket(QTextBlock currentBlock, int i, int numLeftBrackets, QPair<char, char> pair)
-{
-    TextBlockData *data = static_cast<TextBlockData *>(currentBlock.userData());
-    QVector<BracketInfo *> infos = data->brackets();
-
-    int docPos = currentBlock.position();
-    for (; i < infos.size(); ++i) {
-        BracketInfo *info = infos.at(i);
-
-        if (info->character == pair.first) {
-            ++numLeftBrackets;
-            continue;
-        }
-
-        if (info->character == pair.second) {
-            if (numLeftBrackets == 0) {
-                createBracketSelection(docPos + info->position, QColor(42, 161, 179));
-                return true;
-            } else
-                --numLeftBrackets;
-        }
-    }
-
-    currentBlock = currentBlock.next();
-    if (currentBlock.isValid())
-        return matchLeftBracket(currentBlock, 0, numLeftBrackets, pair);
-
-    return false;
-}
-
-bool CodeEditor::matchRightBracket(QTextBlock currentBlock, int i, int numRightBrackets, QPair<char, char> pair)
+void CodeEditor::gotoEnclosingBrace()
 {
-    TextBlockData *data = static_cast<TextBlockData *>(currentBlock.userData());
-    QVector<BracketInfo *> brackets = data->brackets();
-
-    int docPos = currentBlock.position();
-    for (; i > -1 && brackets.size() > 0; --i) {
-        BracketInfo *info = brackets.at(i);
-        if (info->character == pair.second) {
-            ++numRightBrackets;
-            continue;
-        }
-        if (info->character == pair.first) {
-            if (numRightBrackets == 0) {
-                createBracketSelection(docPos + info->position, QColor(42, 161, 179));
-                return true;
-            } else
-                --numRightBrackets;
-        }
-    }
-
-    currentBlock = currentBlock.previous();
-    if (currentBlock.isValid()) {
-        data = static_cast<TextBlockData *>(currentBlock.userData());
-        brackets = data->brackets();
-        int sz = brackets.size();
-        return matchRightBracket(currentBlock, sz-1, numRightBrackets, pair);
-    }
-
-    return false;
+    QTextCursor tc = textCursor();
+    TextBlockData *data = static_cast<TextBlockData *>(tc.block().userData());
+    if (!data || !data->index)
+        return;
+    int position = data->index->enclosing(data, tc.positionInBlock(), '{');
+    if (position == -1)
+        return;
+    tc.setPosition(position);
+    setTextCursor(tc);
 }
 
 void CodeEditor::createBracketSelection(int pos, QColor color)
 {
-    QList<QTextEdit::ExtraSelection> selections = extraSelections();
-
     QTextEdit::ExtraSelection selection;
     QTextCharFormat format = selection.format;
     format.setBackground(color);
@@ -469,9 +476,7 @@ void CodeEditor::createBracketSelection(int pos, QColor color)
     cursor.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor);
     selection.cursor = cursor;
 
-    selections.append(selection);
-
-    setExtraSelections(selections);
+    bracketSelections.append(selection);
 }
 
 int CodeEditor::lineNumberAreaWidth()
@@ -483,7 +488,7 @@ int CodeEditor::lineNumberAreaWidth()
         ++digits;
     }
 
-    int space = 3 + fontMetrics().horizontalAdvance(QLatin1Char('9')) * (digits +2);
+    int space = 3 + fontMetrics().horizontalAdvance(QLatin1Char('9')) * (digits +2) + gutter.laneWidth();
 
     return space;
 }
@@ -507,58 +512,140 @@ void CodeEditor::updateLineNumberArea(const QRect &rect, int dy)
 void CodeEditor::resizeEvent(QResizeEvent *e)
 {
     QPlainTextEdit::resizeEvent(e);
+    visibleTimer->start();
+    decorations->schedule();
 
     QRect cr = contentsRect();
     lineNumberArea->setGeometry(QRect(cr.left(), cr.top(), lineNumberAreaWidth(), cr.height()));
 }
 
-void CodeEditor::highlightCurrentLine()
+void CodeEditor::highlightVisible()
 {
-    QList<QTextEdit::ExtraSelection> extraSelections;
+    if (!highlighter)
+        return;
+    int first = firstVisibleBlock().blockNumber();
+    int last = cursorForPosition(QPoint(0, viewport()->height() - 1)).blockNumber();
+    highlighter->highlightVisible(first, last);
+}
 
-    if (!isReadOnly()) {
-        QTextEdit::ExtraSelection selection;
+void CodeEditor::highlightCurrentLine()
+{
+    matchBrackets();
+    decorations->schedule();
+}
 
-        QColor lineColor = QColor(51, 51, 51);
+static bool inRange(int position, const QTextBlock &first, const QTextBlock &last)
+{
+    return position >= first.position() && position < last.position() + last.length();
+}
 
-        selection.format.setBackground(lineColor);
+// Current line, debugger line, search hits, brackets and the selections of
+// extra cursors, in drawing order.
+// Diagnostics are painted separately in paintEvent.
+void CodeEditor::setupDecorations()
+{
+    decorations = new Decorations(this);
+    decorations->addProvider([this](const QTextBlock &first, const QTextBlock &last,
+                                    QList<QTextEdit::ExtraSelection> &selections) {
+        if (isReadOnly() || !inRange(textCursor().position(), first, last))
+            return;
+        QTextEdit::ExtraSelection selection;
+        selection.format.setBackground(QColor(51, 51, 51));
         selection.format.setProperty(QTextFormat::FullWidthSelection, true);
         selection.cursor = textCursor();
         selection.cursor.clearSelection();
-        extraSelections.append(selection);
-    }
+        selections.append(selection);
+    });
+    decorations->addProvider([this](const QTextBlock &first, const QTextBlock &last,
+                                    QList<QTextEdit::ExtraSelection> &selections) {
+        if (stepNumber < first.blockNumber() || stepNumber > last.blockNumber())
+            return;
+        QTextEdit::ExtraSelection selection;
+        selection.format.setBackground(QColor(80, 70, 20));
+        selection.format.setProperty(QTextFormat::FullWidthSelection, true);
+        selection.cursor = QTextCursor(document()->findBlockByNumber(stepNumber));
+        selections.append(selection);
+    });
+    decorations->addProvider([this](const QTextBlock &first, const QTextBlock &last,
+                                    QList<QTextEdit::ExtraSelection> &selections) {
+        if (searchText.isEmpty())
+            return;
+        for (QTextBlock block = first; block.isValid() && block.blockNumber() <= last.blockNumber(); block = block.next()) {
+            QString text = block.text();
+            for (int i = text.indexOf(searchText, 0, Qt::CaseInsensitive); i != -1;
+                 i = text.indexOf(searchText, i + searchText.size(), Qt::CaseInsensitive)) {
+                QTextEdit::ExtraSelection selection;
+                selection.format.setBackground(QColor(90, 90, 40));
+                selection.cursor = QTextCursor(block);
+                selection.cursor.setPosition(block.position() + i);
+                selection.cursor.setPosition(block.position() + i + searchText.size(), QTextCursor::KeepAnchor);
+                selections.append(selection);
+            }
+        }
+    });
+    decorations->addProvider([this](const QTextBlock &first, const QTextBlock &last,
+                                    QList<QTextEdit::ExtraSelection> &selections) {
+        for (const auto &selection: bracketSelections) {
+            if (inRange(selection.cursor.position(), first, last))
+                selections.append(selection);
+        }
+    });
+    decorations->addProvider([this](const QTextBlock &first, const QTextBlock &last,
+                                    QList<QTextEdit::ExtraSelection> &selections) {
+        for (const auto &cursor: extraCursors) {
+            if (!cursor.hasSelection() || !inRange(cursor.position(), first, last))
+                continue;
+            QTextEdit::ExtraSelection selection;
+            selection.format.setBackground(palette().highlight());
+            selection.format.setForeground(palette().highlightedText());
+            selection.cursor = cursor;
+            selections.append(selection);
+        }
+    });
+}
 
-    setExtraSelections(extraSelections);
+void CodeEditor::setSearchText(const QString &text)
+{
+    searchText = text;
+    decorations->schedule();
+}
 
-    matchBrackets();
+void CodeEditor::setStepNumber(int line)
+{
+    stepNumber = line;
+    decorations->schedule();
+    gutter.invalidate();
+    lineNumberArea->update();
 }
 
-void CodeEditor::lineNumberAreaPaintEvent(QPaintEvent *event)
+void CodeEditor::toggleBreakpoint(int line)
 {
-    QPainter painter(lineNumberArea);
-    painter.fillRect(event->rect(), QColor(51, 51, 51));
+    auto it = std::lower_bound(breakpoints.begin(), breakpoints.end(), line);
+    if (it != breakpoints.end() && *it == line)
+        breakpoints.erase(it);
+    else
+        breakpoints.insert(it, line);
+    gutter.invalidate();
+    lineNumberArea->update();
+}
 
+// Only the visible rows are collected here; drawing them, and skipping the
+// drawing when nothing changed, is left to the gutter.
+void CodeEditor::lineNumberAreaPaintEvent(QPaintEvent *)
+{
+    gutterRows.resize(0);
     QTextBlock block = firstVisibleBlock();
     int blockNumber = block.blockNumber();
     int top = (int) blockBoundingGeometry(block).translated(contentOffset()).top();
     int bottom = top + (int) blockBoundingRect(block).height();
-
-    while (block.isValid() && top <= event->rect().bottom()) {
-        if (block.isVisible() && bottom >= event->rect().top()) {
-            QString number = QString::number(blockNumber + 1);
-            painter.setPen(Qt::lightGray);
-            painter.drawText(-(2+fontMetrics().horizontalAdvance(QLatin1Char('9'))), top, lineNumberArea->width(), fontMetrics().height(),
-                             Qt::AlignRight, number);
-            if (breakpoints.contains(blockNumber)) {
-                painter.setPen(Qt::red);
-                painter.drawText(0, top, lineNumberArea->width(), fontMetrics().height(),
-                                 Qt::AlignLeft, "●");
-            }
-            if (stepNumber == blockNumber) {
-                painter.setPen(Qt::yellow);
-                painter.drawText(0, top, lineNumberArea->width(), fontMetrics().height(),
-                                 Qt::AlignLeft, "▶");
-            }
+    auto breakpoint = std::lower_bound(breakpoints.constBegin(), breakpoints.constEnd(), blockNumber);
+
+    while (block.isValid() && top <= lineNumberArea->height()) {
+        if (block.isVisible() && bottom >= 0) {
+            while (breakpoint != breakpoints.constEnd() && *breakpoint < blockNumber)
+                ++breakpoint;
+            bool isBreakpoint = breakpoint != breakpoints.constEnd() && *breakpoint == blockNumber;
+            gutterRows.append({blockNumber, top, block, isBreakpoint, stepNumber == blockNumber});
         }
 
         block = block.next();
@@ -566,6 +653,9 @@ void CodeEditor::lineNumberAreaPaintEvent(QPaintEvent *event)
         bottom = top + (int) blockBoundingRect(block).height();
         ++blockNumber;
     }
+
+    QPainter painter(lineNumberArea);
+    gutter.paint(painter, font(), lineNumberArea->size(), lineNumberArea->devicePixelRatioF(), gutterRows);
 }
 
 void CodeEditor::setCompleter()
@@ -575,7 +665,7 @@ void CodeEditor::setCompleter()
         return;
 
     c->setWidget(this);
-        c->setCompletionMode(QCompleter::PopupCompletion);
+        c->setCompletionMode(QCompleter::UnfilteredPopupCompletion);
         c->setCaseSensitivity(Qt::CaseInsensitive);
         QObject::connect(c, QOverload<const QString &>::of(&QCompleter::activated),
                          this, &CodeEditor::insertCompletion);
@@ -591,11 +681,14 @@ void CodeEditor::insertCompletion(const QString &completion)
     if (c->widget() != this)
         return;
     QTextCursor tc = textCursor();
-    int extra = completion.length() - c->completionPrefix().length();
     tc.movePosition(QTextCursor::Left);
     tc.movePosition(QTextCursor::EndOfWord);
+    int end = tc.position();
+    tc.movePosition(QTextCursor::StartOfWord);
+    tc.setPosition(end, QTextCursor::KeepAnchor);
     setTextCursor(tc);
-    pushAddCommand(completion.right(extra));
+    pushAddCommand(completion);
+    completionStart = -1;
 }
 
 QString CodeEditor::textUnderCursor() const
@@ -638,130 +731,544 @@ int CodeEditor::getRange(QJsonObject range) {
 }
 
 void CodeEditor::sendChange(QTextCursor tc, QString text, int length, bool add) {
-    QJsonObject params;
-    QJsonObject versioned;
-    version++;
-    versioned.insert("uri", uri);
-    versioned.insert("version", version);
-    params.insert("textDocument", versioned);
-    QJsonObject contentChangeEvent;
-    QJsonArray contentChangeEvents;
-    QJsonObject range;
-    range.insert("end", getPosition(tc));
-    tc.clearSelection();
-    tc.movePosition(QTextCursor::Left, QTextCursor::MoveAnchor, length);
-    range.insert("start", getPosition(tc));
-    tc.movePosition(QTextCursor::Right, QTextCursor::KeepAnchor, length);
+    setTextCursor(applyChange(tc, text, length, add));
+}
+
+// Replaces the length characters before tc and queues the change for the
+// server, leaving the editor's own cursor alone.
+QTextCursor CodeEditor::applyChange(QTextCursor tc, const QString &text, int length, bool add)
+{
+    int endLine = tc.blockNumber();
+    int endCharacter = tc.positionInBlock();
+    int end = tc.position();
+    tc.setPosition(end - length);
+    pendingChanges.append({false, tc.blockNumber(), tc.positionInBlock(), endLine, endCharacter, text});
+    diagnostics.remap(tc.position(), length, add ? text.size() : 0);
+    tc.setPosition(end, QTextCursor::KeepAnchor);
     tc.removeSelectedText();
     if (add)
         tc.insertText(text);
-    setTextCursor(tc);
-    contentChangeEvent.insert("range", range);
-    contentChangeEvent.insert("text", text);
-    contentChangeEvents.append(contentChangeEvent);
-    params.insert("contentChanges", contentChangeEvents);
-    QJsonObject changeNotification = rls->createRequest("textDocument/didChange", params);
-    if (!diagnostics.empty()) {
-        tc.select(QTextCursor::Document);
-        tc.setCharFormat(defFormat);
-        diagnostics.clear();
+    hoverCache.clear();
+    changeTimer->start();
+    return tc;
+}
+
+void CodeEditor::setCursors(const QVector<int> &positions, int primary)
+{
+    extraCursors.clear();
+    int end = document()->characterCount() - 1;
+    for (int i = 0; i < positions.size(); i++) {
+        if (i == primary)
+            continue;
+        QTextCursor tc(document());
+        tc.setPosition(qMin(positions.at(i), end));
+        extraCursors.append(tc);
     }
-    rls->sendRequest(changeNotification);
-}
-
-void CodeEditor::rebootRls(int exitCode, QProcess::ExitStatus exitStatus)
-{
-    if (exitCode != 0)
-        std::cerr << exitCode << ' ' << exitStatus << "\n";
-
-    if (rls->keep) {
-        disconnect(rls->ls, SIGNAL(readyReadStandardOutput()), this, SLOT(processResponse()));
-        disconnect(rls->ls,static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, &CodeEditor::rebootRls);
-        rls->start();
-        connect(rls->ls, SIGNAL(readyReadStandardOutput()), this, SLOT(processResponse()));
-        connect(rls->ls,static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, &CodeEditor::rebootRls);
-        QJsonObject params;
-        QJsonObject versioned;
-        version++;
-        versioned.insert("uri", uri);
-        versioned.insert("version", version);
-        params.insert("textDocument", versioned);
-        QJsonObject contentChangeEvent;
-        QJsonArray contentChangeEvents;
-        QFile file(filePath);
-
-        QString raw = document()->toRawText();
-        contentChangeEvent.insert("text", raw);
-        contentChangeEvents.append(contentChangeEvent);
-        params.insert("contentChanges", contentChangeEvents);
-        QJsonObject changeNotification = rls->createRequest("textDocument/didChange", params);
-        rls->sendRequest(changeNotification);
+    if (primary < positions.size()) {
+        QTextCursor tc = textCursor();
+        tc.setPosition(qMin(positions.at(primary), end));
+        setTextCursor(tc);
     }
+    decorations->schedule();
+    viewport()->update();
 }
 
-void CodeEditor::processResponse()
+void CodeEditor::clearCursors()
 {
-    QVector<QJsonObject> responses = rls->getResponses();
-    if (responses.isEmpty())
+    if (extraCursors.isEmpty())
         return;
-    QVector<Diagnostic> diags;
-    for (const auto &response: responses) {
-        if (response.value("method") == "textDocument/publishDiagnostics") {
-            QJsonObject params = response.value("params").toObject();
-            QJsonArray dv = params.value("diagnostics").toArray();
-            std::cerr << dv.size() << '\n';
-            for (const auto &diagnostic: dv) {
-                QJsonObject d = diagnostic.toObject();
-                QJsonObject r = d.value("range").toObject();
-                int severity = d.value("severity").toInt();
-                int start = getRange(r.value("start").toObject());
-                int end = getRange(r.value("end").toObject());
-                QString message = d.value("message").toString();
-                std::cerr << start << ' ' << end << "\"" << message.toStdString() << "\"\n\n";
-                if (start == -1)
-                    continue;
-                  diags.push_back({start, end-start, severity, message});
-            }
-        } else {
-            QJsonValue res = response.value("result");
-            if (res.isObject()) {
-                QJsonObject result = res.toObject();
-                QJsonObject contents = result.value("contents").toObject();
-                codeTip = contents.value("value").toString();
-            } else if (res.isArray()) {
-                QJsonArray items = res.toArray();
-                QStringList words;
-                for (const auto &item: items) {
-                    QString label = item.toObject().value("label").toString();
-                    words << label;
-                }
-                QStringListModel* model = static_cast<QStringListModel*>(c->model());
-                model->setStringList(words);
-                maxRows = words.size();
-                currentRow = 0;
-
-                if (completionPrefix != c->completionPrefix()) {
-                    c->setCompletionPrefix(completionPrefix);
-                    c->popup()->setCurrentIndex(c->completionModel()->index(0, 0));
-                }
-                QRect cr = cursorRect();
-                cr.setWidth(c->popup()->sizeHintForColumn(0)
-                            + c->popup()->verticalScrollBar()->sizeHint().width());
-                c->complete(cr);
+    extraCursors.clear();
+    decorations->schedule();
+    viewport()->update();
+}
+
+void CodeEditor::addCursor(bool below)
+{
+    QTextCursor tc = textCursor();
+    for (const auto &cursor: extraCursors) {
+        if (below ? cursor.position() > tc.position() : cursor.position() < tc.position())
+            tc = cursor;
+    }
+    tc.clearSelection();
+    int position = tc.position();
+    if (!tc.movePosition(below ? QTextCursor::Down : QTextCursor::Up) || tc.position() == position)
+        return;
+    extraCursors.append(tc);
+    decorations->schedule();
+    viewport()->update();
+}
+
+// With several cursors, typing, deleting and moving apply to all of them;
+// any other key drops back to the main cursor. Each keystroke is one undo
+// step.
+bool CodeEditor::multiCursorKey(QKeyEvent *e)
+{
+    if (e->key() == Qt::Key_Escape) {
+        clearCursors();
+        return true;
+    }
+    QTextCursor::MoveOperation move = QTextCursor::NoMove;
+    switch (e->key()) {
+    case Qt::Key_Left: move = QTextCursor::Left; break;
+    case Qt::Key_Right: move = QTextCursor::Right; break;
+    case Qt::Key_Up: move = QTextCursor::Up; break;
+    case Qt::Key_Down: move = QTextCursor::Down; break;
+    case Qt::Key_Home: move = QTextCursor::StartOfLine; break;
+    case Qt::Key_End: move = QTextCursor::EndOfLine; break;
+    default: break;
+    }
+    bool modified = e->modifiers() & (Qt::ControlModifier | Qt::AltModifier | Qt::MetaModifier);
+    if (move != QTextCursor::NoMove && !modified) {
+        QTextCursor::MoveMode mode = e->modifiers() & Qt::ShiftModifier ? QTextCursor::KeepAnchor : QTextCursor::MoveAnchor;
+        for (auto &cursor: extraCursors)
+            cursor.movePosition(move, mode);
+        QTextCursor tc = textCursor();
+        tc.movePosition(move, mode);
+        setTextCursor(tc);
+        decorations->schedule();
+        viewport()->update();
+        return true;
+    }
+
+    QString text = e->text();
+    if (e->key() == Qt::Key_Return || e->key() == Qt::Key_Enter)
+        text = "\n";
+    else if (e->key() == Qt::Key_Tab)
+        text = "    ";
+    bool backspace = e->key() == Qt::Key_Backspace;
+    bool erase = backspace || e->key() == Qt::Key_Delete;
+    if (modified || (!erase && (text.isEmpty() || (text != "\n" && !text.at(0).isPrint())))) {
+        clearCursors();
+        return false;
+    }
+
+    QTextCursor main = textCursor();
+    QList<QTextCursor> cursors = extraCursors;
+    cursors.prepend(main);
+    std::sort(cursors.begin(), cursors.end(), [](const QTextCursor &a, const QTextCursor &b) {
+        return a.selectionStart() < b.selectionStart();
+    });
+    // Overlapping ranges become one edit; ranges that only touch, like two
+    // backspaces on neighbouring columns, stay separate.
+    auto textBetween = [this](int start, int end) -> QString {
+        QTextCursor range(document());
+        range.setPosition(start);
+        range.setPosition(end, QTextCursor::KeepAnchor);
+        return range.selectedText().replace(QChar::ParagraphSeparator, '\n');
+    };
+    QVector<CursorEdit> edits;
+    int primary = 0;
+    int documentEnd = document()->characterCount() - 1;
+    for (const auto &cursor: cursors) {
+        int start = cursor.selectionStart();
+        int end = cursor.selectionEnd();
+        if (!cursor.hasSelection() && backspace)
+            start = qMax(0, start - 1);
+        else if (!cursor.hasSelection() && erase)
+            end = qMin(documentEnd, end + 1);
+        if (start == end && erase)
+            continue;
+        if (!edits.isEmpty()) {
+            CursorEdit &last = edits.last();
+            int lastEnd = last.start + last.removed.size();
+            if (start < lastEnd || (start == end && start == last.start)) {
+                if (end > lastEnd)
+                    last.removed = textBetween(last.start, end);
+                if (cursor == main)
+                    primary = edits.size() - 1;
+                continue;
             }
         }
+        if (cursor == main)
+            primary = edits.size();
+        edits.append({start, textBetween(start, end), erase ? QString() : text});
     }
-    for (const auto &d: diags) {
-        QTextCursor tc = textCursor();
-        tc.setPosition(d.position, QTextCursor::MoveAnchor);
-        tc.movePosition(QTextCursor::Right, QTextCursor::KeepAnchor, d.length);
-        if (d.severity == 1) {
-            tc.setCharFormat(errorFormat);
-        } else {
-            tc.setCharFormat(warningFormat);
+    if (edits.isEmpty())
+        return true;
+    if (undoStack->index() < undoIndex)
+        undoIndex = -1;
+    undoStack->push(new MultiAddCommand(this, edits, primary));
+    return true;
+}
+
+int CodeEditor::columnAt(const QPoint &pos) const
+{
+    qreal x = pos.x() - contentOffset().x() - document()->documentMargin();
+    return qMax(0, qRound(x / fontMetrics().horizontalAdvance(QLatin1Char(' '))));
+}
+
+// Alt+drag selects the same columns on every line between the press and the
+// pointer, one cursor per line.
+void CodeEditor::selectRectangle(const QPoint &pos)
+{
+    int line = cursorForPosition(pos).blockNumber();
+    int column = columnAt(pos);
+    extraCursors.clear();
+    QTextBlock block = document()->findBlockByNumber(qMin(line, rectangleLine));
+    for (; block.isValid() && block.blockNumber() <= qMax(line, rectangleLine); block = block.next()) {
+        QTextCursor tc(block);
+        tc.setPosition(block.position() + qMin(rectangleColumn, block.length() - 1));
+        tc.setPosition(block.position() + qMin(column, block.length() - 1), QTextCursor::KeepAnchor);
+        if (block.blockNumber() == rectangleLine)
+            setTextCursor(tc);
+        else
+            extraCursors.append(tc);
+    }
+    decorations->schedule();
+    viewport()->update();
+}
+
+void CodeEditor::mousePressEvent(QMouseEvent *e)
+{
+    if (e->button() == Qt::LeftButton && e->modifiers() == Qt::AltModifier) {
+        QTextCursor tc = cursorForPosition(e->pos());
+        rectangleLine = tc.blockNumber();
+        rectangleColumn = columnAt(e->pos());
+        if (tc.position() != textCursor().position())
+            extraCursors.append(tc);
+        decorations->schedule();
+        viewport()->update();
+        return;
+    }
+    clearCursors();
+    QPlainTextEdit::mousePressEvent(e);
+}
+
+void CodeEditor::mouseReleaseEvent(QMouseEvent *e)
+{
+    rectangleLine = -1;
+    rectangleColumn = -1;
+    QPlainTextEdit::mouseReleaseEvent(e);
+}
+
+// Edits are sent as one didChange per idle interval, or earlier when a
+// request needs the server to see the current text.
+void CodeEditor::flushChanges() {
+    changeTimer->stop();
+    if (pendingChanges.isEmpty())
+        return;
+    if (rls->capabilities.sync == ServerCapabilities::Sync::none) {
+        pendingChanges.resize(0);
+        return;
+    }
+    int batched = pendingChanges.size();
+    if (rls->capabilities.sync == ServerCapabilities::Sync::full) {
+        pendingChanges.resize(0);
+        pendingChanges.append({true, 0, 0, 0, 0, toPlainText()});
+    }
+    version++;
+    rls->sendChanges(uri, version, pendingChanges);
+    rls->count("didChange notifications saved", batched - 1);
+    pendingChanges.resize(0);
+    requestSemanticTokens();
+}
+
+void CodeEditor::setUri(const QString &uri)
+{
+    this->uri = uri;
+    rls->dispatcher->attach(uri, this, [this](const Message &message) {
+        processNotification(message);
+    });
+    rls->openDocument(uri, this, [this]() -> DocumentSnapshot {
+        changeTimer->stop();
+        pendingChanges.resize(0);
+        semanticResultId.clear();
+        QTimer::singleShot(0, this, [this]() {
+            requestSemanticTokens();
+        });
+        return {toPlainText(), version};
+    });
+    if (rls->capabilities.semanticTokensFull)
+        requestVisibleTokens();
+    requestSemanticTokens();
+}
+
+static QVector<uint> tokenData(const QJsonArray &array)
+{
+    QVector<uint> data;
+    data.reserve(array.size());
+    for (const auto &value: array)
+        data.append(uint(value.toInt()));
+    return data;
+}
+
+// The whole file is asked for as a delta against the previous result when
+// the server supports it. Servers that only do ranges are asked for the
+// visible lines.
+void CodeEditor::requestSemanticTokens()
+{
+    if (!highlighter || uri.isEmpty())
+        return;
+    if (!rls->capabilities.semanticTokensFull) {
+        requestVisibleTokens();
+        return;
+    }
+    QJsonObject textDocument;
+    textDocument.insert("uri", uri);
+    QJsonObject params;
+    params.insert("textDocument", textDocument);
+    QString method = "textDocument/semanticTokens/full";
+    if (!semanticResultId.isEmpty() && rls->capabilities.semanticTokensDelta) {
+        method += "/delta";
+        params.insert("previousResultId", semanticResultId);
+    }
+    int id = requests.value("semanticTokens", -1);
+    if (id != -1)
+        rls->cancel(id);
+    requests.insert("semanticTokens", rls->request(method, params, this, [this](const QJsonValue &result) {
+        showSemanticTokens(result);
+    }));
+}
+
+void CodeEditor::requestVisibleTokens()
+{
+    if (!highlighter || uri.isEmpty() || !rls->capabilities.semanticTokensRange)
+        return;
+    int firstLine = firstVisibleBlock().blockNumber();
+    QTextBlock last = cursorForPosition(QPoint(0, viewport()->height() - 1)).block();
+    int lastLine = last.blockNumber();
+    QJsonObject start;
+    start.insert("line", firstLine);
+    start.insert("character", 0);
+    QJsonObject end;
+    end.insert("line", lastLine);
+    end.insert("character", last.length() - 1);
+    QJsonObject range;
+    range.insert("start", start);
+    range.insert("end", end);
+    QJsonObject textDocument;
+    textDocument.insert("uri", uri);
+    QJsonObject params;
+    params.insert("textDocument", textDocument);
+    params.insert("range", range);
+    int id = requests.value("semanticTokens/range", -1);
+    if (id != -1)
+        rls->cancel(id);
+    requests.insert("semanticTokens/range", rls->request("textDocument/semanticTokens/range", params, this,
+                                                         [this, firstLine, lastLine](const QJsonValue &result) {
+        highlighter->setLegend(rls->capabilities.tokenTypes);
+        highlighter->setRangeTokens(firstLine, lastLine, tokenData(result.toObject().value("data").toArray()));
+    }));
+}
+
+void CodeEditor::showSemanticTokens(const QJsonValue &result)
+{
+    QJsonObject tokens = result.toObject();
+    highlighter->setLegend(rls->capabilities.tokenTypes);
+    semanticResultId = tokens.value("resultId").toString();
+    if (tokens.contains("edits")) {
+        QVector<SemanticEdit> edits;
+        for (const auto &value: tokens.value("edits").toArray()) {
+            QJsonObject edit = value.toObject();
+            edits.append({edit.value("start").toInt(), edit.value("deleteCount").toInt(),
+                          tokenData(edit.value("data").toArray())});
+        }
+        highlighter->applySemanticEdits(edits);
+    } else {
+        highlighter->setSemanticTokens(tokenData(tokens.value("data").toArray()));
+    }
+}
+
+void CodeEditor::processNotification(const Message &message)
+{
+    if (message.method != "textDocument/publishDiagnostics")
+        return;
+    // Diagnostics computed for an older version, or published while edits
+    // are still waiting to be sent, point at text that has since changed.
+    // The ones shown are remapped through those edits, and newer ones follow
+    // the next flush.
+    QJsonObject params = message.object.value("params").toObject();
+    if (!pendingChanges.isEmpty()
+            || (params.value("version").isDouble() && params.value("version").toInt() < version))
+        return;
+    QVector<Diagnostic> diags;
+    QJsonArray dv = params.value("diagnostics").toArray();
+    for (const auto &diagnostic: dv) {
+        QJsonObject d = diagnostic.toObject();
+        QJsonObject r = d.value("range").toObject();
+        int severity = d.value("severity").toInt(2);
+        int start = getRange(r.value("start").toObject());
+        int end = getRange(r.value("end").toObject());
+        QString text = d.value("message").toString();
+        if (start == -1)
+            continue;
+        diags.push_back({start, qMax(0, end-start), severity, text});
+    }
+    diagnostics.set(diags);
+    gutter.invalidate();
+    viewport()->update();
+    lineNumberArea->update();
+}
+
+void CodeEditor::gotoDiagnostic(const Diagnostic *diagnostic)
+{
+    if (!diagnostic)
+        return;
+    QTextCursor tc = textCursor();
+    tc.setPosition(qMin(diagnostic->position, document()->characterCount() - 1));
+    setTextCursor(tc);
+    centerCursor();
+    QRect rect = cursorRect();
+    QToolTip::showText(viewport()->mapToGlobal(rect.bottomLeft()), diagnostic->message, this);
+}
+
+// Both directions wrap around at the ends of the document.
+void CodeEditor::nextDiagnostic()
+{
+    const Diagnostic *diagnostic = diagnostics.next(textCursor().position());
+    gotoDiagnostic(diagnostic ? diagnostic : diagnostics.next(-1));
+}
+
+void CodeEditor::previousDiagnostic()
+{
+    const Diagnostic *diagnostic = diagnostics.previous(textCursor().position());
+    gotoDiagnostic(diagnostic ? diagnostic : diagnostics.previous(INT_MAX));
+}
+
+static void drawWave(QPainter &painter, qreal left, qreal right, qreal y)
+{
+    QPainterPath path;
+    path.moveTo(left, y);
+    bool up = true;
+    for (qreal x = left + 2; x < right + 2; x += 2, up = !up)
+        path.lineTo(x, up ? y - 1.5 : y + 1.5);
+    painter.drawPath(path);
+}
+
+// Diagnostics are painted over the visible blocks rather than stored as
+// character formats, so edits never touch the document's formatting.
+void CodeEditor::paintEvent(QPaintEvent *event)
+{
+    QPlainTextEdit::paintEvent(event);
+    if (!extraCursors.isEmpty()) {
+        QPainter painter(viewport());
+        for (const auto &cursor: extraCursors) {
+            QRect rect = cursorRect(cursor);
+            if (rect.intersects(event->rect()))
+                painter.fillRect(rect.x(), rect.y(), cursorWidth(), rect.height(), palette().text());
+        }
+    }
+    if (diagnostics.isEmpty())
+        return;
+    QPainter painter(viewport());
+    painter.setRenderHint(QPainter::Antialiasing);
+    QPointF offset = contentOffset();
+    for (QTextBlock block = firstVisibleBlock(); block.isValid(); block = block.next()) {
+        QRectF rect = blockBoundingGeometry(block).translated(offset);
+        if (rect.top() > event->rect().bottom())
+            break;
+        if (!block.isVisible() || rect.bottom() < event->rect().top())
+            continue;
+        int blockStart = block.position();
+        int blockEnd = blockStart + block.length() - 1;
+        const QVector<Diagnostic> &items = diagnostics.diagnostics();
+        for (int i = diagnostics.firstReaching(blockStart); i < items.size() && items.at(i).position <= blockEnd; i++) {
+            const Diagnostic &d = items.at(i);
+            if (!d.reaches(blockStart))
+                continue;
+            int from = qMax(d.position, blockStart) - blockStart;
+            int to = qMin(d.position + d.length, blockEnd) - blockStart;
+            QTextLine line = block.layout()->lineForTextPosition(from);
+            if (!line.isValid())
+                continue;
+            qreal left = rect.left() + line.cursorToX(from);
+            qreal right = to > from ? rect.left() + line.cursorToX(to) : left + fontMetrics().horizontalAdvance(QLatin1Char('9'));
+            painter.setPen(d.severity == 1 ? Qt::red : Qt::yellow);
+            drawWave(painter, left, right, rect.top() + line.y() + line.ascent() + 2);
         }
     }
-    diagnostics.append(diags);
+}
+
+static QString markupText(const QJsonValue &value)
+{
+    if (value.isString())
+        return value.toString();
+    if (value.isObject())
+        return value.toObject().value("value").toString();
+    QStringList parts;
+    for (const auto &part: value.toArray())
+        parts << markupText(part);
+    return parts.join('\n');
+}
+
+void CodeEditor::showHover(const QString &key, int requested, const QJsonValue &result)
+{
+    if (requested != version || !pendingChanges.isEmpty())
+        return;
+    QString text = markupText(result.toObject().value("contents"));
+    hoverCache.insert(key, text);
+    if (!text.isEmpty() && !hoverTimer->isActive() && key == tipKey(cursorForPosition(hoverPos)))
+        QToolTip::showText(viewport()->mapToGlobal(hoverPos), text, this);
+}
+
+void CodeEditor::showCompletion(const QJsonValue &result)
+{
+    if (completionStart == -1)
+        return;
+    QJsonArray items = result.isArray() ? result.toArray() : result.toObject().value("items").toArray();
+    completionIncomplete = result.toObject().value("isIncomplete").toBool();
+    QStringList words;
+    for (const auto &item: items) {
+        QString label = item.toObject().value("label").toString();
+        words << label;
+    }
+    completions.setLabels(words);
+    filterCompletion();
+}
+
+// The server's list for the start of a word is filtered here as the word
+// grows; it is only asked again when it said the list was incomplete.
+void CodeEditor::filterCompletion()
+{
+    QStringList words;
+    for (int index: completions.match(completionPrefix))
+        words << completions.label(index);
+    QStringListModel* model = static_cast<QStringListModel*>(c->model());
+    model->setStringList(words);
+    maxRows = words.size();
+    currentRow = 0;
+    if (words.isEmpty()) {
+        c->popup()->hide();
+        return;
+    }
+
+    c->popup()->setCurrentIndex(c->completionModel()->index(0, 0));
+    QRect cr = cursorRect();
+    cr.setWidth(c->popup()->sizeHintForColumn(0)
+                + c->popup()->verticalScrollBar()->sizeHint().width());
+    c->complete(cr);
+}
+
+void CodeEditor::showDefinition(const QJsonValue &result)
+{
+    QJsonObject location = result.toObject();
+    if (result.isArray()) {
+        QJsonArray locations = result.toArray();
+        if (locations.isEmpty())
+            return;
+        location = locations.at(0).toObject();
+    }
+    QString target = location.value("uri").toString();
+    QJsonObject range = location.value("range").toObject();
+    if (location.contains("targetUri")) {
+        target = location.value("targetUri").toString();
+        range = location.value("targetSelectionRange").toObject();
+    }
+    if (target.isEmpty())
+        return;
+    QJsonObject start = range.value("start").toObject();
+    if (target == uri) {
+        int pos = getRange(start);
+        if (pos == -1)
+            return;
+        QTextCursor tc = textCursor();
+        tc.setPosition(pos);
+        setTextCursor(tc);
+        centerCursor();
+    } else {
+        QString path = QUrl(target).toLocalFile();
+        emit openLocation(path, start.value("line").toInt(), start.value("character").toInt());
+    }
 }
 
 void CodeEditor::braceIndent() {
@@ -785,6 +1292,12 @@ void CodeEditor::braceIndent() {
 
 void CodeEditor::keyPressEvent(QKeyEvent *e)
 {
+    if (e->modifiers() == (Qt::ControlModifier | Qt::AltModifier) && (e->key() == Qt::Key_Up || e->key() == Qt::Key_Down)) {
+        addCursor(e->key() == Qt::Key_Down);
+        return;
+    }
+    if (!extraCursors.isEmpty() && multiCursorKey(e))
+        return;
     indent.clear();
     QTextCursor tc0 = textCursor();
     tc0.movePosition(QTextCursor::Right, QTextCursor::KeepAnchor);
@@ -1108,15 +1621,21 @@ void CodeEditor::keyPressEvent(QKeyEvent *e)
         QPlainTextEdit::keyPressEvent(e);
     }
 
+    // A trigger character such as '.' asks for completions straight away,
+    // and the list stays up while the word after it grows.
     completionPrefix = textUnderCursor();
-    if (hasModifier || e->text().isEmpty()|| completionPrefix.length() < 3
-                      || eow.contains(e->text().right(1))) {
+    QString typed = e->text().right(1);
+    bool trigger = !hasModifier && !typed.isEmpty() && rls && rls->capabilities.completionTriggers.contains(typed);
+    if (trigger)
+        completionPrefix.clear();
+    bool continued = completionStart != -1 && textCursor().position() - completionPrefix.length() == completionStart;
+    if (!trigger && (hasModifier || typed.isEmpty() || (completionPrefix.length() < 3 && !continued)
+                     || eow.contains(typed))) {
         c->popup()->hide();
+        completionStart = -1;
         return;
     }
 
-    if (completionPrefix.length() >= 3 && !e->text().isEmpty()) {
-        getCompletion();
-    }
+    getCompletion();
 
 }
@@ -33,25 +33,21 @@
 #include <QProcess>
 #include <QUndoStack>
 #include "lsp.h"
+#include "highlighter.h"
+#include "diagnosticindex.h"
+#include "fuzzymatcher.h"
+#include "decorations.h"
+#include "gutter.h"
 
 class QPaintEvent;
 class QResizeEvent;
 class QSize;
 class QWidget;
 class QCompleter;
+class QTimer;
 
 class LineNumberArea;
 
-class Diagnostic
-{
-public:
-    Diagnostic(int position, int length, int severity, QString message): position(position), length(length), severity(severity), message(message) {}
-    int position;
-    int length;
-    int severity;
-    QString message;
-};
-
 class CodeEditor : public QPlainTextEdit
 {
     Q_OBJECT
@@ -63,6 +59,13 @@ public:
     void lineNumberAreaPaintEvent(QPaintEvent *event);
     int lineNumberAreaWidth();
     void sendChange(QTextCursor tc, QString text, int length, bool add = true);
+    QTextCursor applyChange(QTextCursor tc, const QString &text, int length, bool add = true);
+    void setCursors(const QVector<int> &positions, int primary = 0);
+    void flushChanges();
+    void setSearchText(const QString &text);
+    void setStepNumber(int line);
+    void toggleBreakpoint(int line);
+    void setUri(const QString &uri);
     void setCompleter();
     void loadFile(const QString &fileName);
     bool maybeSave();
@@ -70,23 +73,37 @@ public:
     QCompleter *completer() const;
     QUndoStack *undoStack;
     Client *rls = nullptr;
+    Highlighter *highlighter = nullptr;
+    Decorations *decorations;
     QString uri;
     QString fileName;
     QString filePath;
-    QVector<int> breakpoints;
+    QVector<int> breakpoints; // sorted
     int stepNumber = -1;
     int undoIndex = 0;
 
 protected:
     bool event(QEvent *event) override;
     void resizeEvent(QResizeEvent *event) override;
+    void paintEvent(QPaintEvent *event) override;
 
     void keyPressEvent(QKeyEvent *e) override;
     void focusInEvent(QFocusEvent *e) override;
+    void mousePressEvent(QMouseEvent *e) override;
+    void mouseMoveEvent(QMouseEvent *e) override;
+    void mouseReleaseEvent(QMouseEvent *e) override;
+    void leaveEvent(QEvent *e) override;
     void closeEvent(QCloseEvent *event) override;
 
 public slots:
     bool saveAs();
+    void followSymbol();
+    void gotoEnclosingBrace();
+    void nextDiagnostic();
+    void previousDiagnostic();
+
+signals:
+    void openLocation(const QString &path, int line, int character);
 
 private slots:
     void updateLineNumberAreaWidth(int newBlockCount);
@@ -95,40 +112,70 @@ private slots:
 
     void matchBrackets();
     void insertCompletion(const QString &completion);
-    void processResponse();
-    void rebootRls(int exitCode, QProcess::ExitStatus exitStatus);
+    void processNotification(const Message &message);
+    void showTip();
     void open();
     bool save();
 
 private:
     QWidget *lineNumberArea;
-
-    bool matchLeftBracket(QTextBlock currentBlock, int index, int numRightBrackets, QPair<char, char> pair);
-    bool matchRightBracket(QTextBlock currentBlock, int index, int numLeftBrackets, QPair<char, char> pair);
+    Gutter gutter;
+    QVector<GutterRow> gutterRows;
+
+    void setupDecorations();
+    void addCursor(bool below);
+    bool multiCursorKey(QKeyEvent *e);
+    void clearCursors();
+    void selectRectangle(const QPoint &pos);
+    int columnAt(const QPoint &pos) const;
     void createBracketSelection(int pos, QColor color);
     void pushAddCommand(QString s);
     void pushRemoveCommand(QString s);
     int getRange(QJsonObject range);
     void braceIndent();
-    void getTip(const QPoint &pos);
+    QString tipKey(const QTextCursor &tc) const;
     void getCompletion();
+    void request(const QString &method, const QTextCursor &tc, Client::Callback callback);
+    void showHover(const QString &key, int requested, const QJsonValue &result);
+    void showCompletion(const QJsonValue &result);
+    void filterCompletion();
+    void showDefinition(const QJsonValue &result);
+    void requestSemanticTokens();
+    void requestVisibleTokens();
+    void highlightVisible();
+    void showSemanticTokens(const QJsonValue &result);
     bool saveFile(const QString &fileName);
-
-    QString codeTip;
+    void gotoDiagnostic(const Diagnostic *diagnostic);
+
+    QList<QTextEdit::ExtraSelection> bracketSelections;
+    QList<QTextCursor> extraCursors;
+    int rectangleLine = -1;
+    int rectangleColumn = -1;
+    QString searchText;
+    QTimer *hoverTimer;
+    QPoint hoverPos;
+    QHash<QString, QString> hoverCache;
     QRegularExpression commentExpression;
     QRegularExpression endExpression;
     QRegularExpression blankExpression;
 
-    QVector<Diagnostic> diagnostics;
-    QTextCharFormat defFormat;
-    QTextCharFormat warningFormat;
-    QTextCharFormat errorFormat;
+    QHash<QString, int> requests;
+    QVector<ContentChange> pendingChanges;
+    QTimer *changeTimer;
+    QTimer *semanticTimer;
+    QTimer *visibleTimer;
+    QString semanticResultId;
+    DiagnosticIndex diagnostics;
     QString textUnderCursor() const;
     QCompleter *c = nullptr;
     QColor didMatch = QColor(42, 161, 179);
     QColor noMatch = QColor(Qt::red);
     QString indent;
     QString completionPrefix;
+    QString requestedPrefix;
+    FuzzyMatcher completions;
+    int completionStart = -1;
+    bool completionIncomplete = false;
     bool inString = false;
     int brackets = 0;
     int movement = 0;
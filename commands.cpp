@@ -108,3 +108,56 @@ void RemoveCommand::redo()
     QString e = "";
     editor->sendChange(tc, e, s.size());
 }
+
+// One edit per cursor, sorted by start and not overlapping. They are applied
+// from the last one back so the earlier starts stay valid, inside a single
+// edit block so the document is laid out and highlighted once, and their
+// ranges go to the server together in the next didChange. The main cursor
+// stays with the edit it made.
+MultiAddCommand::MultiAddCommand(CodeEditor* editor, QVector<CursorEdit> edits, int primary, QUndoCommand *parent)
+    : QUndoCommand(parent), editor(editor), edits(edits), primary(primary)
+{
+}
+
+void MultiAddCommand::undo()
+{
+    QVector<int> shifts;
+    int shift = 0;
+    for (const auto &edit: edits) {
+        shifts.append(shift);
+        shift += edit.inserted.size() - edit.removed.size();
+    }
+    QTextCursor batch(editor->document());
+    batch.beginEditBlock();
+    for (int i = edits.size() - 1; i >= 0; i--) {
+        const CursorEdit &edit = edits.at(i);
+        QTextCursor tc(editor->document());
+        tc.setPosition(edit.start + shifts.at(i) + edit.inserted.size());
+        editor->applyChange(tc, edit.removed, edit.inserted.size());
+    }
+    batch.endEditBlock();
+    QVector<int> cursors;
+    for (const auto &edit: edits)
+        cursors.append(edit.start + edit.removed.size());
+    editor->setCursors(cursors, primary);
+}
+
+void MultiAddCommand::redo()
+{
+    QTextCursor batch(editor->document());
+    batch.beginEditBlock();
+    for (int i = edits.size() - 1; i >= 0; i--) {
+        const CursorEdit &edit = edits.at(i);
+        QTextCursor tc(editor->document());
+        tc.setPosition(edit.start + edit.removed.size());
+        editor->applyChange(tc, edit.inserted, edit.removed.size());
+    }
+    batch.endEditBlock();
+    QVector<int> cursors;
+    int shift = 0;
+    for (const auto &edit: edits) {
+        cursors.append(edit.start + shift + edit.inserted.size());
+        shift += edit.inserted.size() - edit.removed.size();
+    }
+    editor->setCursors(cursors, primary);
+}
@@ -84,4 +84,25 @@ private:
     QTextCursor tc;
 };
 
+struct CursorEdit
+{
+    int start;
+    QString removed;
+    QString inserted;
+};
+
+class MultiAddCommand : public QUndoCommand
+{
+public:
+    MultiAddCommand(CodeEditor* editor, QVector<CursorEdit> edits, int primary, QUndoCommand *parent = nullptr);
+
+    void undo() override;
+    void redo() override;
+
+private:
+    CodeEditor* editor;
+    QVector<CursorEdit> edits;
+    int primary;
+};
+
 #endif // COMMANDS_H
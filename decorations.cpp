@@ -0,0 +1,76 @@
+/* Copyright (c) 2021, sarutora
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "decorations.h"
+
+#include <QScrollBar>
+#include <QTimer>
+
+Decorations::Decorations(QPlainTextEdit *editor)
+    : QObject(editor), editor(editor)
+{
+    connect(editor->verticalScrollBar(), &QScrollBar::valueChanged, this, &Decorations::schedule);
+}
+
+void Decorations::addProvider(const Provider &provider)
+{
+    providers.append(provider);
+    schedule();
+}
+
+void Decorations::schedule()
+{
+    if (scheduled)
+        return;
+    scheduled = true;
+    QTimer::singleShot(0, this, &Decorations::commit);
+}
+
+void Decorations::commit()
+{
+    scheduled = false;
+    QTextBlock first = editor->cursorForPosition(QPoint(0, 0)).block();
+    QTextBlock last = editor->cursorForPosition(QPoint(0, editor->viewport()->height() - 1)).block();
+    QList<QTextEdit::ExtraSelection> selections;
+    for (const auto &provider: providers)
+        provider(first, last, selections);
+    editor->setExtraSelections(selections);
+
+    qint64 elapsed = window.isValid() ? window.elapsed() : 0;
+    if (!window.isValid() || elapsed >= 1000) {
+        rate = window.isValid() ? int(windowCommits * 1000 / elapsed) : 0;
+        windowCommits = 0;
+        window.start();
+    }
+    windowCommits++;
+}
+
+// Counted over the last window of a second or more that has closed.
+int Decorations::commitsPerSecond() const
+{
+    return rate;
+}
@@ -0,0 +1,65 @@
+/* Copyright (c) 2021, sarutora
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef DECORATIONS_H
+#define DECORATIONS_H
+
+#include <QElapsedTimer>
+#include <QPlainTextEdit>
+#include <functional>
+
+// Collects extra selections from independent providers and hands them to
+// the editor in a single setExtraSelections call per trip through the
+// event loop, however many providers asked for an update in between.
+// Providers are only asked about the visible blocks, and later providers
+// draw on top of earlier ones.
+class Decorations : public QObject
+{
+    Q_OBJECT
+
+public:
+    using Provider = std::function<void(const QTextBlock &first, const QTextBlock &last,
+                                        QList<QTextEdit::ExtraSelection> &selections)>;
+
+    explicit Decorations(QPlainTextEdit *editor);
+    void addProvider(const Provider &provider);
+    void schedule();
+    int commitsPerSecond() const;
+
+private slots:
+    void commit();
+
+private:
+    QPlainTextEdit *editor;
+    QVector<Provider> providers;
+    bool scheduled = false;
+    QElapsedTimer window;
+    int windowCommits = 0;
+    int rate = 0;
+};
+
+#endif // DECORATIONS_H
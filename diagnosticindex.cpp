@@ -0,0 +1,136 @@
+/* Copyright (c) 2021, sarutora
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "diagnosticindex.h"
+
+#include <algorithm>
+
+void DiagnosticIndex::set(QVector<Diagnostic> diagnostics)
+{
+    std::stable_sort(diagnostics.begin(), diagnostics.end(), [](const Diagnostic &a, const Diagnostic &b) {
+        return a.position < b.position;
+    });
+    items.swap(diagnostics);
+    rebuild(0);
+}
+
+void DiagnosticIndex::clear()
+{
+    items.clear();
+    reach.clear();
+}
+
+bool DiagnosticIndex::isEmpty() const
+{
+    return items.isEmpty();
+}
+
+const QVector<Diagnostic> &DiagnosticIndex::diagnostics() const
+{
+    return items;
+}
+
+void DiagnosticIndex::rebuild(int from)
+{
+    reach.resize(items.size());
+    for (int i = from; i < items.size(); i++) {
+        int end = items.at(i).position + items.at(i).length;
+        reach[i] = i ? qMax(reach.at(i - 1), end) : end;
+    }
+}
+
+// The first diagnostic that the prefix reach says could end at or after
+// the position; everything before it ends earlier.
+int DiagnosticIndex::firstReaching(int position) const
+{
+    return int(std::lower_bound(reach.constBegin(), reach.constEnd(), position) - reach.constBegin());
+}
+
+// A diagnostic whose start was deleted moves to the end of the replacement,
+// and one whose end was deleted stops where the edit began. Both mappings
+// are monotonic, so the order holds and only the reach from the first
+// touched diagnostic on needs recomputing.
+void DiagnosticIndex::remap(int position, int removed, int added)
+{
+    int removedEnd = position + removed;
+    int first = firstReaching(position);
+    for (int i = first; i < items.size(); i++) {
+        Diagnostic &d = items[i];
+        int start = d.position;
+        int end = d.position + d.length;
+        if (start >= removedEnd)
+            start += added - removed;
+        else if (start > position)
+            start = position + added;
+        if (end >= removedEnd)
+            end += added - removed;
+        else if (end > position)
+            end = position;
+        d.position = start;
+        d.length = qMax(0, end - start);
+    }
+    rebuild(first);
+}
+
+const Diagnostic *DiagnosticIndex::at(int position) const
+{
+    for (int i = firstReaching(position + 1); i < items.size() && items.at(i).position <= position; i++) {
+        const Diagnostic &d = items.at(i);
+        if (position < d.position + d.length)
+            return &d;
+    }
+    return nullptr;
+}
+
+const Diagnostic *DiagnosticIndex::next(int position) const
+{
+    auto it = std::upper_bound(items.constBegin(), items.constEnd(), position, [](int position, const Diagnostic &d) {
+        return position < d.position;
+    });
+    return it == items.constEnd() ? nullptr : &*it;
+}
+
+const Diagnostic *DiagnosticIndex::previous(int position) const
+{
+    auto it = std::lower_bound(items.constBegin(), items.constEnd(), position, [](const Diagnostic &d, int position) {
+        return d.position < position;
+    });
+    return it == items.constBegin() ? nullptr : &*(it - 1);
+}
+
+// The most severe diagnostic touching [start, end], or 0 if there is none.
+// Severity 1 is an error, so lower is worse.
+int DiagnosticIndex::severityIn(int start, int end) const
+{
+    int severity = 0;
+    for (int i = firstReaching(start); i < items.size() && items.at(i).position <= end; i++) {
+        const Diagnostic &d = items.at(i);
+        if (d.reaches(start) && (!severity || d.severity < severity))
+            severity = d.severity;
+    }
+    return severity;
+}
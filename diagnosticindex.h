@@ -0,0 +1,72 @@
+/* Copyright (c) 2021, sarutora
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef DIAGNOSTICINDEX_H
+#define DIAGNOSTICINDEX_H
+
+#include <QString>
+#include <QVector>
+
+class Diagnostic
+{
+public:
+    Diagnostic(int position, int length, int severity, QString message): position(position), length(length), severity(severity), message(message) {}
+    // A range that ends where a line starts does not cover that line;
+    // an empty one still marks its own position.
+    bool reaches(int start) const { return length > 0 ? position + length > start : position >= start; }
+    int position;
+    int length;
+    int severity;
+    QString message;
+};
+
+// Diagnostics sorted by start, with the furthest end reached by any prefix
+// alongside, so lookups by position or range are binary searches. Edits
+// shift the diagnostics after them in place, keeping the order.
+class DiagnosticIndex
+{
+public:
+    void set(QVector<Diagnostic> diagnostics);
+    void clear();
+    bool isEmpty() const;
+    void remap(int position, int removed, int added);
+
+    const Diagnostic *at(int position) const;
+    const Diagnostic *next(int position) const;
+    const Diagnostic *previous(int position) const;
+    int severityIn(int start, int end) const;
+    int firstReaching(int position) const;
+    const QVector<Diagnostic> &diagnostics() const;
+
+private:
+    void rebuild(int from);
+
+    QVector<Diagnostic> items;
+    QVector<int> reach;
+};
+
+#endif // DIAGNOSTICINDEX_H
@@ -0,0 +1,136 @@
+/* Copyright (c) 2021, sarutora
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "fuzzymatcher.h"
+
+#include <algorithm>
+#include <climits>
+
+static quint64 charBit(ushort c)
+{
+    if (c >= 'a' && c <= 'z')
+        return quint64(1) << (c - 'a');
+    if (c >= '0' && c <= '9')
+        return quint64(1) << (26 + c - '0');
+    if (c == '_')
+        return quint64(1) << 36;
+    return quint64(1) << 37;
+}
+
+static ushort fold(QChar c)
+{
+    return c.toLower().unicode();
+}
+
+void FuzzyMatcher::setLabels(const QStringList &labels)
+{
+    this->labels = labels;
+    arena.resize(0);
+    offsets.resize(0);
+    masks.resize(0);
+    for (const auto &label: labels) {
+        offsets.append(arena.size());
+        quint64 mask = 0;
+        for (QChar c: label) {
+            ushort folded = fold(c);
+            arena.append(folded);
+            mask |= charBit(folded);
+        }
+        masks.append(mask);
+    }
+    offsets.append(arena.size());
+}
+
+const QString &FuzzyMatcher::label(int index) const
+{
+    return labels.at(index);
+}
+
+int FuzzyMatcher::size() const
+{
+    return labels.size();
+}
+
+// Matched characters score more at the start of the label or of a word
+// inside it, right after the previous match, and when the case agrees.
+// Long labels can score below zero, so INT_MIN marks a label the pattern
+// is not a subsequence of.
+int FuzzyMatcher::score(int index, const QVector<ushort> &pattern, const QString &raw) const
+{
+    const ushort *text = arena.constData() + offsets.at(index);
+    int length = offsets.at(index + 1) - offsets.at(index);
+    const QString &label = labels.at(index);
+    int score = 0;
+    int last = -2;
+    int j = 0;
+    for (int i = 0; i < length && j < pattern.size(); i++) {
+        if (text[i] != pattern.at(j))
+            continue;
+        int bonus = 1;
+        if (i == 0)
+            bonus += 8;
+        else if (label.at(i - 1) == '_' || label.at(i - 1) == ':'
+                 || (label.at(i).isUpper() && label.at(i - 1).isLower()))
+            bonus += 6;
+        if (last == i - 1)
+            bonus += 5;
+        if (label.at(i) == raw.at(j))
+            bonus += 1;
+        score += bonus;
+        last = i;
+        j++;
+    }
+    if (j < pattern.size())
+        return INT_MIN;
+    return score * 16 - (length - pattern.size());
+}
+
+QVector<int> FuzzyMatcher::match(const QString &pattern) const
+{
+    QVector<ushort> folded;
+    quint64 mask = 0;
+    for (QChar c: pattern) {
+        folded.append(fold(c));
+        mask |= charBit(folded.last());
+    }
+    QVector<QPair<int, int>> scored;
+    for (int i = 0; i < masks.size(); i++) {
+        if (mask & ~masks.at(i))
+            continue;
+        int s = score(i, folded, pattern);
+        if (s != INT_MIN)
+            scored.append({-s, i});
+    }
+    std::stable_sort(scored.begin(), scored.end(), [](const QPair<int, int> &a, const QPair<int, int> &b) {
+        return a.first < b.first;
+    });
+    QVector<int> indices;
+    indices.reserve(scored.size());
+    for (const auto &entry: scored)
+        indices.append(entry.second);
+    return indices;
+}
@@ -0,0 +1,114 @@
+/* Copyright (c) 2021, sarutora
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "gutter.h"
+
+void Gutter::addLane(const Lane &lane)
+{
+    lanes.append(lane);
+    valid = false;
+}
+
+int Gutter::laneWidth() const
+{
+    return lanes.size() * 3;
+}
+
+void Gutter::invalidate()
+{
+    valid = false;
+}
+
+void Gutter::renderDigits(const QFont &font, qreal ratio)
+{
+    QFontMetrics metrics(font);
+    digitFont = font;
+    this->ratio = ratio;
+    digitWidth = metrics.horizontalAdvance(QLatin1Char('9'));
+    digitHeight = metrics.height();
+    digits = QPixmap(QSize(digitWidth * 10, digitHeight) * ratio);
+    digits.setDevicePixelRatio(ratio);
+    digits.fill(Qt::transparent);
+    QPainter painter(&digits);
+    painter.setFont(font);
+    painter.setPen(Qt::lightGray);
+    for (int i = 0; i < 10; i++)
+        painter.drawText(QRect(i * digitWidth, 0, digitWidth, digitHeight), Qt::AlignCenter, QString(QChar('0' + i)));
+    valid = false;
+}
+
+void Gutter::drawNumber(QPainter &painter, int right, int top, int number) const
+{
+    int x = right;
+    do {
+        x -= digitWidth;
+        QRectF source((number % 10) * digitWidth * ratio, 0, digitWidth * ratio, digitHeight * ratio);
+        painter.drawPixmap(QPointF(x, top), digits, source);
+        number /= 10;
+    } while (number);
+}
+
+void Gutter::render(const QFont &font, const QSize &size, const QVector<GutterRow> &rows)
+{
+    strip = QPixmap(size * ratio);
+    strip.setDevicePixelRatio(ratio);
+    strip.fill(QColor(51, 51, 51));
+    QPainter painter(&strip);
+    painter.setFont(font);
+    int numberRight = size.width() - laneWidth() - 2;
+    for (const auto &row: rows) {
+        drawNumber(painter, numberRight, row.top, row.number + 1);
+        for (int i = 0; i < lanes.size(); i++) {
+            QColor color = lanes.at(i)(row.block);
+            if (color.isValid())
+                painter.fillRect(size.width() - 3 * (i + 1), row.top, 3, digitHeight, color);
+        }
+        if (row.breakpoint) {
+            painter.setPen(Qt::red);
+            painter.drawText(0, row.top, size.width(), digitHeight, Qt::AlignLeft, "●");
+        }
+        if (row.step) {
+            painter.setPen(Qt::yellow);
+            painter.drawText(0, row.top, size.width(), digitHeight, Qt::AlignLeft, "▶");
+        }
+    }
+    firstNumber = rows.isEmpty() ? -1 : rows.first().number;
+    firstTop = rows.isEmpty() ? 0 : rows.first().top;
+    rowCount = rows.size();
+    valid = true;
+}
+
+void Gutter::paint(QPainter &painter, const QFont &font, const QSize &size, qreal ratio,
+                   const QVector<GutterRow> &rows)
+{
+    if (digits.isNull() || font != digitFont || ratio != this->ratio)
+        renderDigits(font, ratio);
+    if (!valid || strip.size() != size * ratio || rows.size() != rowCount
+            || (!rows.isEmpty() && (rows.first().number != firstNumber || rows.first().top != firstTop)))
+        render(font, size, rows);
+    painter.drawPixmap(0, 0, strip);
+}
@@ -0,0 +1,80 @@
+/* Copyright (c) 2021, sarutora
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef GUTTER_H
+#define GUTTER_H
+
+#include <QPainter>
+#include <QPixmap>
+#include <QTextBlock>
+#include <functional>
+
+struct GutterRow
+{
+    int number;
+    int top;
+    QTextBlock block;
+    bool breakpoint;
+    bool step;
+};
+
+// Renders the line number area. Digits are blitted from a pixmap drawn once
+// per font, and the finished strip is kept until the rows or anything drawn
+// in them change, so repainting an unchanged gutter is a single blit.
+// Lanes are three pixel columns along the right edge, each coloured by a
+// callback per block, or left empty when it returns an invalid colour.
+class Gutter
+{
+public:
+    using Lane = std::function<QColor(const QTextBlock &block)>;
+
+    void addLane(const Lane &lane);
+    int laneWidth() const;
+    void invalidate();
+    void paint(QPainter &painter, const QFont &font, const QSize &size, qreal ratio,
+               const QVector<GutterRow> &rows);
+
+private:
+    void renderDigits(const QFont &font, qreal ratio);
+    void render(const QFont &font, const QSize &size, const QVector<GutterRow> &rows);
+    void drawNumber(QPainter &painter, int right, int top, int number) const;
+
+    QVector<Lane> lanes;
+    QFont digitFont;
+    QPixmap digits;
+    int digitWidth = 0;
+    int digitHeight = 0;
+    qreal ratio = 0;
+
+    QPixmap strip;
+    bool valid = false;
+    int firstNumber = -1;
+    int firstTop = 0;
+    int rowCount = 0;
+};
+
+#endif // GUTTER_H
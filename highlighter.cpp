@@ -26,330 +26,355 @@
 
 #include "highlighter.h"
 
-QVector<BracketInfo *> TextBlockData::brackets()
+#include <QTextDocument>
+#include <QTextLayout>
+#include <QtConcurrent>
+#include <algorithm>
+#include <climits>
+
+TextBlockData::~TextBlockData()
 {
-    return m_brackets;
+    if (index)
+        index->remove(node);
 }
 
-QVector<QPair<char, char>> TextBlockData::pairs()
+const QVector<BracketInfo> &TextBlockData::brackets() const
 {
-    return {{'(', ')'}, {'[', ']'}, {'{', '}'}};
+    return m_brackets;
 }
 
-
-void TextBlockData::insert(BracketInfo *info)
+// Copies into the existing storage; a block's bracket count rarely grows,
+// so re-highlighting while typing does not allocate.
+void TextBlockData::setBrackets(const BracketInfo *brackets, int count)
 {
-    int i = 0;
-    while (i < m_brackets.size() &&
-        info->position > m_brackets.at(i)->position)
-        ++i;
-
-    m_brackets.insert(i, info);
+    m_brackets.resize(count);
+    std::copy(brackets, brackets + count, m_brackets.begin());
 }
 
 Highlighter::Highlighter(QTextDocument *parent)
-    : QSyntaxHighlighter(parent)
+    : QSyntaxHighlighter(parent), formats(int(TokenKind::macro) + 1)
 {
-    HighlightingRule rule;
-
+    QTextCharFormat keywordFormat;
     keywordFormat.setForeground(QColor(228, 170, 12));
-    QStringList keywordPatterns;
-    keywordPatterns << "\\bas\\b" << "\\basync\\b" << "\\bawait\\b"
-                    << "\\bbreak\\b" << "\\bconst\\b" << "\\bcontinue\\b"
-                    << "\\bcrate\\b" << "\\bdyn\\b" << "\\belse\\b"
-                    << "\\benum\\b" << "\\bextern\\b" << "\\bfn\\b"
-                    << "\\bfor\\b" << "\\bif\\b" << "\\bimpl\\b"
-                    << "\\bin\\b" << "\\blet\\b" << "\\bloop\\b"
-                    << "\\bmatch\\b" << "\\bmod\\b" << "\\bpub\\b"
-                    << "\\bref\\b" << "\\breturn\\b" << "\\bstatic\\b"
-                    << "\\bstruct\\b" << "\\bsuper\\b" << "\\btrait\\b"
-                    << "\\btype\\b" << "\\bunion\\b" << "\\bunsafe\\b"
-                    << "\\buse\\b" << "\\bwhere\\b" <<"\\bwhile\\b"
-                    << "\\|" << "\\=" << "\\+"
-                    << "\\-" << "\\<" << "\\>"
-                    << "\\!" << "\\&" << "\\&\\&";
-    foreach (const QString &pattern, keywordPatterns) {
-        rule.pattern = QRegularExpression(pattern);
-        rule.format = keywordFormat;
-        highlightingRules.append(rule);
+    QTextCharFormat typeFormat;
+    typeFormat.setForeground(QColor(134, 253, 174));
+    QTextCharFormat literalFormat;
+    literalFormat.setForeground(QColor(192, 97, 203));
+    QTextCharFormat commentFormat;
+    commentFormat.setForeground(QColor(51, 199, 222));
+    QTextCharFormat pathFormat;
+    pathFormat.setForeground(QColor(94, 212, 251));
+    escapeFormat.setForeground(QColor(234, 198, 198));
+    functionFormat.setFontWeight(QFont::Bold);
+    functionFormat.setForeground(QColor(51, 199, 222));
+
+    formats[int(TokenKind::keyword)] = keywordFormat;
+    formats[int(TokenKind::type)] = typeFormat;
+    formats[int(TokenKind::literal)] = literalFormat;
+    formats[int(TokenKind::string)] = literalFormat;
+    formats[int(TokenKind::escape)] = escapeFormat;
+    formats[int(TokenKind::comment)] = commentFormat;
+    formats[int(TokenKind::docComment)] = escapeFormat;
+    formats[int(TokenKind::attribute)] = commentFormat;
+    formats[int(TokenKind::lifetime)] = escapeFormat;
+    formats[int(TokenKind::function)] = functionFormat;
+    formats[int(TokenKind::path)] = pathFormat;
+    formats[int(TokenKind::separator)] = escapeFormat;
+    formats[int(TokenKind::macro)] = pathFormat;
+
+    idleTimer = new QTimer(this);
+    idleTimer->setSingleShot(true);
+    connect(idleTimer, &QTimer::timeout, this, &Highlighter::highlightChunk);
+    lexWatcher = new QFutureWatcher<LexedDocument>(this);
+    connect(lexWatcher, &QFutureWatcher<LexedDocument>::finished, this, &Highlighter::lexingFinished);
+    connect(document(), &QTextDocument::contentsChange, this, [this](int position, int, int) {
+        if (chunking || forceLast != -1)
+            return;
+        if (firstPending == INT_MAX)
+            return;
+        firstPending = qMin(firstPending, document()->findBlock(position).blockNumber());
+        idleTimer->start(200);
+    });
+}
+
+void Highlighter::setLegend(const QStringList &tokenTypes)
+{
+    if (tokenTypes == this->tokenTypes)
+        return;
+    this->tokenTypes = tokenTypes;
+    typeFormats.clear();
+    for (const auto &type: tokenTypes) {
+        if (type == "function" || type == "method")
+            typeFormats.append(functionFormat);
+        else if (type == "macro" || type == "namespace")
+            typeFormats.append(formats.at(int(TokenKind::path)));
+        else if (type == "struct" || type == "enum" || type == "interface" || type == "class"
+                 || type == "type" || type == "typeAlias" || type == "typeParameter"
+                 || type == "builtinType" || type == "union")
+            typeFormats.append(formats.at(int(TokenKind::type)));
+        else if (type == "lifetime")
+            typeFormats.append(escapeFormat);
+        else
+            typeFormats.append(QTextCharFormat());
     }
+}
 
-    keywordFormat.setForeground(QColor(134, 253, 174));
-    QStringList keywordPatterns2;
-    keywordPatterns2 << "\\bbool\\b" << "\\bchar\\b" << "\\bf32\\b"
-                     << "\\bf64\\b" << "\\bi8\\b" << "\\bi16\\b"
-                     << "\\bi32\\b" << "\\bi64\\b" << "\\bi128\\b"
-                     << "\\bisize\\b" << "\\bstr\\b" << "\\bu8\\b"
-                     << "\\bu16\\b" << "\\bu32\\b" << "\\bu64\\b"
-                     << "\\bu128\\b" << "\\busize\\b" << "\\bmut\\b"
-                     << "\\bmove\\b" << "\\*" << "\\&(?=[A-Za-z0-9_'])"
-                     << "\\bSelf\\b" << "\\bCopy\\b" << "\\bClone\\b"
-                     << "\\bDebug\\b" << "\\bString\\b" << "\\bVec\\b";
-    foreach (const QString &pattern, keywordPatterns2) {
-        rule.pattern = QRegularExpression(pattern);
-        rule.format = keywordFormat;
-        highlightingRules.append(rule);
+QVector<SemanticToken> Highlighter::decode(const QVector<uint> &data) const
+{
+    QVector<SemanticToken> tokens;
+    tokens.reserve(data.size() / 5);
+    int line = 0;
+    int start = 0;
+    for (int i = 0; i + 4 < data.size(); i += 5) {
+        if (data.at(i) > 0) {
+            line += data.at(i);
+            start = 0;
+        }
+        start += data.at(i + 1);
+        tokens.append({line, start, int(data.at(i + 2)), int(data.at(i + 3))});
     }
+    return tokens;
+}
 
-    literalFormat.setForeground(QColor(192,97,203));
-    rule.pattern = QRegularExpression("\\b[0-9]*");
-    rule.format = literalFormat;
-    highlightingRules.append(rule);
-    rule.pattern = QRegularExpression("\\b[0-9]\\.[0-9_]*");
-    highlightingRules.append(rule);
-    rule.pattern = QRegularExpression("\\bself\\b");
-    highlightingRules.append(rule);
-    rule.pattern = QRegularExpression("\\b[0-9]_[0-9_]*");
-    highlightingRules.append(rule);
-    QStringList keywordPatterns3;
-    keywordPatterns3 << "f32\\b" << "f64\\b" << "i8\\b"
-                     << "i16\\b" << "i32\\b" << "i64\\b"
-                     << "i128\\b" << "isize\\b" << "u8\\b"
-                     << "u16\\b" << "u32\\b" << "u64\\b"
-                     << "u128\\b" << "usize\\b";
-    foreach (const QString &pattern, keywordPatterns3) {
-        rule.pattern = QRegularExpression("\\b[0-9]*_" + pattern);
-        rule.format = literalFormat;
-        highlightingRules.append(rule);
+void Highlighter::rehighlightLines(int first, int last)
+{
+    QTextBlock block = document()->findBlockByNumber(first);
+    while (block.isValid() && block.blockNumber() <= last) {
+        rehighlightBlock(block);
+        block = block.next();
     }
+}
 
-    functionFormat.setForeground(QColor(94, 212, 251));
-    rule.pattern = QRegularExpression("\\b[A-Za-z0-9_]+\\!");
-    rule.format = functionFormat;
-    highlightingRules.append(rule);
-    rule.pattern = QRegularExpression("\\b[A-Za-z0-9_]+(?=::.)");
-    rule.format = functionFormat;
-    highlightingRules.append(rule);
+// A full result is compared line by line with what is shown, so only lines
+// whose tokens changed are highlighted again.
+void Highlighter::setSemanticTokens(const QVector<uint> &data)
+{
+    QVector<SemanticToken> tokens = decode(data);
+    semanticData = data;
+    semanticTokens.swap(tokens);
+    semanticBlockCount = document()->blockCount();
+    const QVector<SemanticToken> &old = tokens;
+    const QVector<SemanticToken> &current = semanticTokens;
+    QVector<int> changed;
+    int i = 0;
+    int j = 0;
+    while (i < old.size() || j < current.size()) {
+        int line = qMin(i < old.size() ? old.at(i).line : INT_MAX,
+                        j < current.size() ? current.at(j).line : INT_MAX);
+        int oldEnd = i;
+        while (oldEnd < old.size() && old.at(oldEnd).line == line)
+            oldEnd++;
+        int currentEnd = j;
+        while (currentEnd < current.size() && current.at(currentEnd).line == line)
+            currentEnd++;
+        bool same = oldEnd - i == currentEnd - j;
+        for (int k = 0; same && k < oldEnd - i; k++) {
+            const SemanticToken &a = old.at(i + k);
+            const SemanticToken &b = current.at(j + k);
+            same = a.start == b.start && a.length == b.length && a.type == b.type;
+        }
+        if (!same)
+            changed.append(line);
+        i = oldEnd;
+        j = currentEnd;
+    }
+    for (int line: changed)
+        rehighlightLines(line, line);
+}
 
-    functionFormat.setFontWeight(QFont::Bold);
-    functionFormat.setForeground(QColor(51, 199, 222));
-    rule.pattern = QRegularExpression("\\b[A-Za-z0-9_]+(?=\\()");
-    rule.format = functionFormat;
-    highlightingRules.append(rule);
-    QStringList keywordPatterns4;
-    keywordPatterns4 << "(?<=struct)" << "(?<=trait)" << "(?<=enum)"
-                     << "(?<=fn)";
-    foreach (const QString &pattern, keywordPatterns4) {
-        rule.pattern = QRegularExpression(pattern + "\\s*[A-Za-z0-9_]+");
-        rule.format = functionFormat;
-        highlightingRules.append(rule);
+// Edits index into the previous data array; applying them from the back
+// keeps the earlier offsets valid. Lines between the tokens surrounding an
+// edit are the only ones whose highlighting can differ.
+void Highlighter::applySemanticEdits(const QVector<SemanticEdit> &edits)
+{
+    QVector<SemanticEdit> sorted = edits;
+    std::sort(sorted.begin(), sorted.end(), [](const SemanticEdit &a, const SemanticEdit &b) {
+        return a.start < b.start;
+    });
+    QVector<QPair<int, int>> spans;
+    int offset = 0;
+    for (const auto &edit: sorted) {
+        spans.append({edit.start + offset, edit.start + offset + edit.data.size()});
+        offset += edit.data.size() - edit.deleteCount;
+    }
+    for (int i = sorted.size() - 1; i >= 0; i--) {
+        const SemanticEdit &edit = sorted.at(i);
+        int start = qMin(edit.start, semanticData.size());
+        semanticData = semanticData.mid(0, start) + edit.data + semanticData.mid(start + edit.deleteCount);
     }
+    semanticTokens = decode(semanticData);
+    semanticBlockCount = document()->blockCount();
+    if (semanticTokens.isEmpty())
+        return;
+    int last = semanticTokens.size() - 1;
+    for (const auto &span: spans) {
+        int before = qBound(0, span.first / 5 - 1, last);
+        int after = qBound(0, (span.second + 4) / 5, last);
+        rehighlightLines(semanticTokens.at(before).line, semanticTokens.at(after).line);
+    }
+}
 
-    literalFormat.setForeground(QColor(234,198,198));
-    rule.pattern = QRegularExpression("::");
-    rule.format = literalFormat;
-    highlightingRules.append(rule);
+void Highlighter::setRangeTokens(int firstLine, int lastLine, const QVector<uint> &data)
+{
+    QVector<SemanticToken> tokens;
+    for (const auto &token: semanticTokens) {
+        if (token.line >= firstLine)
+            break;
+        tokens.append(token);
+    }
+    tokens += decode(data);
+    for (const auto &token: semanticTokens) {
+        if (token.line > lastLine)
+            tokens.append(token);
+    }
+    semanticTokens.swap(tokens);
+    semanticBlockCount = document()->blockCount();
+    rehighlightLines(firstLine, lastLine);
+}
 
-    literalFormat.setForeground(QColor(192,97,203));
-    rule.pattern = QRegularExpression("'\\\\?.'");
-    rule.format = literalFormat;
-    highlightingRules.append(rule);
+// Tokens are laid over the lexical formats. Once lines have been added or
+// removed they no longer line up, so they are left off until the server
+// sends new ones.
+void Highlighter::applySemanticTokens(const QString &text)
+{
+    if (semanticTokens.isEmpty() || semanticBlockCount != document()->blockCount())
+        return;
+    int line = currentBlock().blockNumber();
+    auto it = std::lower_bound(semanticTokens.constBegin(), semanticTokens.constEnd(), line,
+                               [](const SemanticToken &token, int line) {
+        return token.line < line;
+    });
+    for (; it != semanticTokens.constEnd() && it->line == line; ++it) {
+        if (it->type < 0 || it->type >= typeFormats.size() || it->start >= text.length()
+                || !typeFormats.at(it->type).hasProperty(QTextFormat::ForegroundBrush))
+            continue;
+        setFormat(it->start, qMin(it->length, text.length() - it->start), typeFormats.at(it->type));
+    }
+}
 
-    singleLineCommentFormat.setForeground(QColor(51, 199, 222));
-    rule.pattern = QRegularExpression("//[^\n]*");
-    rule.format = singleLineCommentFormat;
-    highlightingRules.append(rule);
-    rule.pattern = QRegularExpression("#\\[[^\n]*");
-    rule.format = singleLineCommentFormat;
-    highlightingRules.append(rule);
+// Each trip through the event loop gets a few milliseconds of highlighting;
+// blocks reached after that keep their old formats and state, which also
+// stops QSyntaxHighlighter from walking on to the next block, and are
+// picked up in idle chunks. Blocks in the visible range are never deferred.
+bool Highlighter::defer()
+{
+    if (forceLast != -1)
+        return currentBlock().blockNumber() > forceLast;
+    if (!passClock.isValid()) {
+        passClock.start();
+        QTimer::singleShot(0, this, [this]() {
+            passClock.invalidate();
+        });
+    }
+    return passClock.elapsed() >= 8;
+}
 
-    escapeFormat.setForeground(QColor(234,198,198));
-    rule.pattern = QRegularExpression("(?<!/)///(?!/)[^\n]*");
-    rule.format = escapeFormat;
-    highlightingRules.append(rule);
-    rule.pattern = QRegularExpression("//\\![^\n]*");
-    rule.format = escapeFormat;
-    highlightingRules.append(rule);
+void Highlighter::highlightVisible(int first, int last)
+{
+    forceLast = last;
+    for (QTextBlock block = document()->findBlockByNumber(first); block.isValid() && block.blockNumber() <= last; block = block.next()) {
+        TextBlockData *data = static_cast<TextBlockData *>(block.userData());
+        if (!data || data->pending)
+            rehighlightBlock(block);
+    }
+    forceLast = -1;
+    if (firstPending != INT_MAX)
+        idleTimer->start(200);
+}
 
-    quotationFormat.setForeground(QColor(192,97,203));
-    quoteStartExpression = QRegularExpression("(?<!')\"(?!')");
-    quoteEndExpression = QRegularExpression("\"");
-    escapeExpression = QRegularExpression("\\\\");
-    controlExpression = QRegularExpression("\\\\.");
-    lifetimeExpression = QRegularExpression("'[A-Za-z0-9_]+(?!')");
+// Lexes a freshly loaded text on the thread pool. The text is implicitly
+// shared, so the worker reads an immutable copy; idle chunks wait for the
+// result and then only copy the finished runs into the blocks. A line is
+// taken from the result only if its text and incoming state still match
+// what was lexed; lines edited in the meantime are lexed on the spot.
+void Highlighter::lexInBackground(const QString &text)
+{
+    lexed = LexedDocument();
+    lexWatcher->setFuture(QtConcurrent::run(lexDocument, text));
+}
 
+void Highlighter::lexingFinished()
+{
+    lexed = lexWatcher->result();
+    idleTimer->start(0);
 }
 
-QVector<QRegularExpressionMatch> Highlighter::findEscape(const QString &text) {
-    int startIndex = 0;
-    QVector<QRegularExpressionMatch> matches;
-    while (startIndex != -1) {
-        QRegularExpressionMatch match = escapeExpression.match(text, startIndex);
-        if (match.capturedStart() != -1) {
-            matches.push_back(match);
-            startIndex = match.capturedEnd()+1;
-        } else {
+void Highlighter::highlightChunk()
+{
+    if (lexWatcher->isRunning())
+        return;
+    QTextBlock block = document()->findBlockByNumber(firstPending == INT_MAX ? 0 : firstPending);
+    for (; block.isValid(); block = block.next()) {
+        TextBlockData *data = static_cast<TextBlockData *>(block.userData());
+        if (!data || data->pending)
             break;
-        }
     }
-    return matches;
+    if (!block.isValid()) {
+        firstPending = INT_MAX;
+        lexed = LexedDocument();
+        return;
+    }
+    firstPending = block.blockNumber();
+    chunking = true;
+    passClock.start();
+    rehighlightBlock(block);
+    chunking = false;
+    passClock.invalidate();
+    idleTimer->start(0);
 }
 
 void Highlighter::highlightBlock(const QString &text)
 {
-    TextBlockData *data = new TextBlockData;
-
-    int commentPos = text.indexOf("//");
-    for (const auto pair: data->pairs()) {
-        int leftPos = text.indexOf(pair.first);
-        while (leftPos != -1) {
-            if (commentPos == -1 || leftPos < commentPos) {
-                BracketInfo *info = new BracketInfo;
-                info->character = pair.first;
-                info->position = leftPos;
-
-                data->insert(info);
-            }
-            leftPos = text.indexOf(pair.first, leftPos + 1);
-        }
-        int rightPos = text.indexOf(pair.second);
-        while (rightPos != -1) {
-            if (commentPos == -1 || rightPos < commentPos) {
-                BracketInfo *info = new BracketInfo;
-                info->character = pair.second;
-                info->position = rightPos;
-
-                data->insert(info);
-            }
-
-            rightPos = text.indexOf(pair.second, rightPos +1);
+    TextBlockData *pending = static_cast<TextBlockData *>(currentBlockUserData());
+    if (currentBlock().blockNumber() != firstPending && defer()) {
+        if (pending) {
+            pending->pending = true;
+            for (const auto &range: currentBlock().layout()->formats())
+                setFormat(range.start, range.length, range.format);
         }
+        firstPending = qMin(firstPending, currentBlock().blockNumber());
+        if (!chunking && forceLast == -1 && !idleTimer->isActive())
+            idleTimer->start(200);
+        return;
     }
-    setCurrentBlockUserData(data);
 
-    foreach (const HighlightingRule &rule, highlightingRules) {
-        QRegularExpressionMatchIterator matchIterator = rule.pattern.globalMatch(text);
-        while (matchIterator.hasNext()) {
-            QRegularExpressionMatch match = matchIterator.next();
-            setFormat(match.capturedStart(), match.capturedLength(), rule.format);
-        }
+    const Token *tokens;
+    const BracketInfo *brackets;
+    int tokenCount;
+    int bracketCount;
+    int number = currentBlock().blockNumber();
+    if (number < lexed.lines.size() && lexed.lines.at(number).length == text.length()
+            && previousBlockState() == (number > 0 ? lexed.lines.at(number - 1).state : -1)
+            && lexed.lines.at(number).hash == qHash(text)) {
+        const LexedLine &line = lexed.lines.at(number);
+        bool last = number + 1 == lexed.lines.size();
+        tokens = lexed.tokens.constData() + line.firstToken;
+        tokenCount = (last ? lexed.tokens.size() : lexed.lines.at(number + 1).firstToken) - line.firstToken;
+        brackets = lexed.brackets.constData() + line.firstBracket;
+        bracketCount = (last ? lexed.brackets.size() : lexed.lines.at(number + 1).firstBracket) - line.firstBracket;
+        setCurrentBlockState(line.state);
+    } else {
+        setCurrentBlockState(lexer.lex(text, previousBlockState()));
+        tokens = lexer.tokens.constData();
+        tokenCount = lexer.tokens.size();
+        brackets = lexer.brackets.constData();
+        bracketCount = lexer.brackets.size();
     }
 
-    auto insertChar = [&](char c, int position) {
-        BracketInfo *info = new BracketInfo;
-        info->character = c;
-        info->position = position;
-        data->insert(info);
-    };
-
-    setCurrentBlockState(0);
-
-    int commentIndex = text.indexOf("//");
-    int startIndex = 0;
-    int prev = previousBlockState();
-    auto findQuote = [&](int n) {
-        if (commentIndex == -1) {
-            startIndex = text.indexOf(quoteStartExpression, n);
-            if (startIndex != -1) {
-                insertChar('\'', startIndex);
-            }
-        } else {
-            int quoteIndex = text.indexOf(quoteStartExpression, n);
-            if (quoteIndex > 0 && quoteIndex < commentIndex) {
-                startIndex = quoteIndex;
-                insertChar('\'', startIndex);
-            } else
-                startIndex = -1;
-        }
-    };
-    if (prev != 1) {
-        findQuote(startIndex);
+    // Block data is updated in place so the block keeps its node in the
+    // bracket index.
+    TextBlockData *data = static_cast<TextBlockData *>(currentBlockUserData());
+    if (!data) {
+        data = new TextBlockData;
+        data->index = &bracketIndex;
+        data->node = bracketIndex.insert(currentBlock(), data);
+        setCurrentBlockUserData(data);
     }
+    data->pending = false;
+    data->setBrackets(brackets, bracketCount);
+    bracketIndex.update(data->node, currentBlock());
 
-    auto findChar = [&](int n) {
-            while (n != -1) {
-                QRegularExpressionMatch match = controlExpression.match(text, n);
-                n = match.capturedStart();
-                if (n != -1 && (commentIndex == -1 || n < commentIndex)) {
-                    QChar c = text.at(n+1);
-                    if (c == 'n' || c == 'r' || c == 't')
-                        setFormat(n, 2, escapeFormat);
-                    else
-                        setFormat(n, 2, basicFormat);
-                    n = match.capturedEnd();
-                }
-                else
-                    break;
-            }
-    };
-    auto findLifetime = [&](int n) {
-            while (n != -1) {
-                n = text.indexOf('\'', n);
-                if (n != -1 && (commentIndex == -1 || n < commentIndex)) {
-                    QRegularExpressionMatch match = lifetimeExpression.match(text, n);
-                    int m = match.capturedEnd();
-                    if (m != -1) {
-                        setFormat(n, match.capturedLength(), escapeFormat);
-                        n = m;
-                    }
-                    else
-                        break;
-                }
-                else
-                    break;
-            }
-    };
-
-    findChar(0);
-    findLifetime(0);
-    QVector<QRegularExpressionMatch> escapes = findEscape(text);
-
-    bool b = false;
-    while (startIndex >= 0) {
-        QRegularExpressionMatch match;
-        if (prev != 1 || b) {
-            match = quoteEndExpression.match(text, startIndex+1);
-        } else {
-            match = quoteEndExpression.match(text, startIndex);
-        }
-        int endIndex = match.capturedStart();
-
-        int n = 0;
-        int quoteLength = 0;
-        if (endIndex == -1) {
-            setCurrentBlockState(1);
-            quoteLength = text.length() - startIndex;
-            n = escapes.length();
-        } else {
-            bool b = false;
-            for (const auto &escape: escapes) {
-                int escEnd = escape.capturedEnd();
-                if (escEnd < endIndex) {
-                    n++;
-                } else if (escEnd == endIndex) {
-                    setFormat(startIndex, escape.capturedStart()-startIndex, quotationFormat);
-                    for (int i = 0; i < n; i++) {
-                        const auto& e = escapes.at(i);
-                        setFormat(e.capturedStart(), 2, escapeFormat);
-                    }
-                    startIndex = endIndex+1;
-                    escapes.remove(0, n);
-                    b = true;
-                    break;
-                } else {
-                    break;
-                }
-            }
-            if (b)
-                continue;
-
-            insertChar('"', endIndex);
-            quoteLength = endIndex - startIndex
-                            + match.capturedLength();
-        }
-        b = true;
-        setFormat(startIndex, quoteLength, quotationFormat);
-        if (n > 0) {
-            for (int i = 0; i < n; i++) {
-                const auto escape = escapes.at(i);
-                setFormat(escape.capturedStart(), escape.capturedLength()+1, escapeFormat);
-            }
-            if (n < escapes.length())
-                escapes.remove(0, n);
-        }
-        int endQuote = startIndex+quoteLength;
-        findQuote(startIndex+quoteLength);
-        findChar(endQuote);
-        findLifetime(endQuote);
-    }
+    for (int i = 0; i < tokenCount; i++)
+        setFormat(tokens[i].start, tokens[i].length, formats.at(int(tokens[i].kind)));
+    applySemanticTokens(text);
 }
@@ -29,27 +29,46 @@
 
 #include <QSyntaxHighlighter>
 #include <QTextCharFormat>
-#include <QRegularExpression>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QTimer>
 #include <iostream>
+#include <climits>
+
+#include "lexer.h"
+#include "bracketindex.h"
 
 class QTextDocument;
 
-struct BracketInfo
+struct SemanticToken
+{
+    int line;
+    int start;
+    int length;
+    int type;
+};
+
+struct SemanticEdit
 {
-    char character;
-    int position;
+    int start;
+    int deleteCount;
+    QVector<uint> data;
 };
 
 class TextBlockData : public QTextBlockUserData
 {
 public:
+    ~TextBlockData();
+
+    const QVector<BracketInfo> &brackets() const;
+    void setBrackets(const BracketInfo *brackets, int count);
 
-    QVector<QPair<char, char>> pairs();
-    QVector<BracketInfo *> brackets();
-    void insert(BracketInfo *info);
+    BracketIndex *index = nullptr;
+    BracketIndex::Node *node = nullptr;
+    bool pending = false;
 
 private:
-    QVector<BracketInfo *> m_brackets;
+    QVector<BracketInfo> m_brackets;
 };
 
 class Highlighter : public QSyntaxHighlighter
@@ -58,34 +77,46 @@ class Highlighter : public QSyntaxHighlighter
 
 public:
     Highlighter(QTextDocument *parent = 0);
+    BracketIndex bracketIndex;
+    void setLegend(const QStringList &tokenTypes);
+    void setSemanticTokens(const QVector<uint> &data);
+    void applySemanticEdits(const QVector<SemanticEdit> &edits);
+    void setRangeTokens(int firstLine, int lastLine, const QVector<uint> &data);
+    void highlightVisible(int first, int last);
+    void lexInBackground(const QString &text);
 
 protected:
     void highlightBlock(const QString &text) override;
 
+private slots:
+    void highlightChunk();
+    void lexingFinished();
+
 private:
-    QVector<QRegularExpressionMatch> findEscape(const QString &text);
-    struct HighlightingRule
-    {
-        QRegularExpression pattern;
-        QTextCharFormat format;
-    };
-    QVector<HighlightingRule> highlightingRules;
-
-    QRegularExpression controlExpression;
-    QRegularExpression quoteStartExpression;
-    QRegularExpression quoteEndExpression;
-    QRegularExpression escapeExpression;
-    QRegularExpression lifetimeExpression;
-
-    QTextCharFormat basicFormat;
-    QTextCharFormat keywordFormat;
-    QTextCharFormat classFormat;
-    QTextCharFormat singleLineCommentFormat;
-    QTextCharFormat quotationFormat;
-    QTextCharFormat literalFormat;
-    QTextCharFormat escapeFormat;
+    bool defer();
+    QVector<SemanticToken> decode(const QVector<uint> &data) const;
+    void rehighlightLines(int first, int last);
+    void applySemanticTokens(const QString &text);
+    RustLexer lexer;
+    QVector<QTextCharFormat> formats;
+
     QTextCharFormat functionFormat;
-    QTextCharFormat invalidFormat;
+    QTextCharFormat escapeFormat;
+
+    QStringList tokenTypes;
+    QVector<QTextCharFormat> typeFormats;
+    QVector<uint> semanticData;
+    QVector<SemanticToken> semanticTokens;
+    int semanticBlockCount = -1;
+
+    QTimer *idleTimer;
+    QElapsedTimer passClock;
+    int firstPending = INT_MAX;
+    int forceLast = -1;
+    bool chunking = false;
+
+    QFutureWatcher<LexedDocument> *lexWatcher;
+    LexedDocument lexed;
 };
 
 #endif 
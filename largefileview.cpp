@@ -0,0 +1,306 @@
+/* Copyright (c) 2021, sarutora
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "largefileview.h"
+
+#include <QtConcurrent>
+#include <QByteArrayMatcher>
+#include <QInputDialog>
+#include <QKeyEvent>
+#include <QPainter>
+#include <QScrollBar>
+#include <algorithm>
+#include <cstring>
+
+static const int maxCheckpoints = 1 << 16;
+static const int maxLineBytes = 1 << 16;
+static const qint64 chunkSize = 1 << 24;
+
+static LineIndex indexLines(const uchar *data, qint64 size, QAtomicInt *cancelled)
+{
+    LineIndex index = {{0}, 64, 1};
+    for (qint64 chunk = 0; chunk < size && !cancelled->loadRelaxed(); chunk += chunkSize) {
+        const uchar *p = data + chunk;
+        const uchar *end = data + qMin(size, chunk + chunkSize);
+        while ((p = static_cast<const uchar *>(memchr(p, '\n', end - p)))) {
+            p++;
+            if (index.lines % index.stride == 0) {
+                index.checkpoints.append(p - data);
+                if (index.checkpoints.size() > maxCheckpoints) {
+                    int kept = (index.checkpoints.size() + 1) / 2;
+                    for (int i = 1; i < kept; i++)
+                        index.checkpoints[i] = index.checkpoints.at(2 * i);
+                    index.checkpoints.resize(kept);
+                    index.stride *= 2;
+                }
+            }
+            index.lines++;
+        }
+    }
+    return index;
+}
+
+static uchar fold(uchar c)
+{
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+// Finds the first match starting in [from, to). Letters are compared
+// without case, like the editor's Find; only ASCII is folded, so a match
+// is always a byte range of the file.
+static qint64 search(const uchar *data, qint64 size, QByteArray pattern, qint64 from, qint64 to, QAtomicInt *cancelled)
+{
+    for (char &c: pattern)
+        c = char(fold(uchar(c)));
+    QByteArrayMatcher matcher(pattern);
+    QByteArray folded;
+    for (qint64 chunk = from; chunk < to && !cancelled->loadRelaxed(); chunk += chunkSize) {
+        int length = int(qMin(size - chunk, chunkSize + pattern.size() - 1));
+        folded.resize(length);
+        char *out = folded.data();
+        for (int i = 0; i < length; i++)
+            out[i] = char(fold(data[chunk + i]));
+        int found = matcher.indexIn(folded.constData(), length);
+        if (found != -1)
+            return chunk + found < to ? chunk + found : -1;
+    }
+    return -1;
+}
+
+LargeFileView::LargeFileView(const QString &path, QWidget *parent)
+    : QAbstractScrollArea(parent), filePath(path), file(path)
+{
+    fileName = path.mid(path.lastIndexOf('/') + 1);
+    index = {{0}, 64, 1};
+    if (file.open(QFile::ReadOnly)) {
+        size = file.size();
+        data = file.map(0, size);
+    }
+    watcher = new QFutureWatcher<LineIndex>(this);
+    connect(watcher, &QFutureWatcher<LineIndex>::finished, this, &LargeFileView::indexingFinished);
+    if (data)
+        watcher->setFuture(QtConcurrent::run(indexLines, data, size, &cancelled));
+    searchWatcher = new QFutureWatcher<qint64>(this);
+    connect(searchWatcher, &QFutureWatcher<qint64>::finished, this, &LargeFileView::searchFinished);
+    setFocusPolicy(Qt::StrongFocus);
+}
+
+LargeFileView::~LargeFileView()
+{
+    cancelled.storeRelaxed(1);
+    watcher->waitForFinished();
+    searchWatcher->waitForFinished();
+}
+
+bool LargeFileView::isMapped() const
+{
+    return data;
+}
+
+void LargeFileView::indexingFinished()
+{
+    index = watcher->result();
+    indexed = true;
+    updateRanges();
+    updateWindow();
+    viewport()->update();
+}
+
+qint64 LargeFileView::lineEnd(qint64 offset) const
+{
+    const void *end = memchr(data + offset, '\n', size - offset);
+    return end ? static_cast<const uchar *>(end) - data : size;
+}
+
+qint64 LargeFileView::lineOffset(qint64 line) const
+{
+    int checkpoint = int(qMin<qint64>(line / index.stride, index.checkpoints.size() - 1));
+    qint64 offset = index.checkpoints.at(checkpoint);
+    for (qint64 skip = line - qint64(checkpoint) * index.stride; skip > 0 && offset < size; skip--)
+        offset = lineEnd(offset) + 1;
+    return qMin(offset, size);
+}
+
+qint64 LargeFileView::lineAt(qint64 offset) const
+{
+    auto it = std::upper_bound(index.checkpoints.constBegin(), index.checkpoints.constEnd(), offset);
+    int checkpoint = int(it - index.checkpoints.constBegin()) - 1;
+    qint64 line = qint64(checkpoint) * index.stride;
+    for (qint64 start = index.checkpoints.at(checkpoint); lineEnd(start) < offset; start = lineEnd(start) + 1)
+        line++;
+    return line;
+}
+
+void LargeFileView::gotoLine(qint64 line)
+{
+    int rows = viewport()->height() / fontMetrics().height();
+    if (line < windowFirst || line >= windowFirst + rows)
+        verticalScrollBar()->setValue(int(qMin<qint64>(qMax<qint64>(0, line - rows / 2), INT_MAX)));
+}
+
+void LargeFileView::find(const QString &text)
+{
+    pattern = text.toUtf8();
+    matchOffset = lineOffset(windowFirst) - 1;
+    findNext();
+}
+
+// Searches run on the thread pool, wrapping around at the end of the file.
+// A search asked for while one is running starts when that one finishes.
+void LargeFileView::findNext()
+{
+    if (pattern.isEmpty() || !data)
+        return;
+    if (searchWatcher->isRunning()) {
+        searchQueued = true;
+        return;
+    }
+    searching = pattern;
+    const uchar *data = this->data;
+    qint64 size = this->size;
+    QByteArray pattern = this->pattern;
+    qint64 from = matchOffset + 1;
+    QAtomicInt *cancelled = &this->cancelled;
+    searchWatcher->setFuture(QtConcurrent::run([=]() -> qint64 {
+        qint64 found = search(data, size, pattern, from, size, cancelled);
+        return found != -1 ? found : search(data, size, pattern, 0, from, cancelled);
+    }));
+}
+
+void LargeFileView::searchFinished()
+{
+    if (searching == pattern) {
+        qint64 found = searchWatcher->result();
+        matchOffset = found;
+        if (found != -1)
+            gotoLine(lineAt(found));
+        viewport()->update();
+    }
+    if (searchQueued) {
+        searchQueued = false;
+        findNext();
+    }
+}
+
+int LargeFileView::gutterWidth() const
+{
+    int digits = QString::number(qMax<qint64>(1, index.lines)).size();
+    return 3 + fontMetrics().horizontalAdvance(QLatin1Char('9')) * (digits + 2);
+}
+
+void LargeFileView::updateRanges()
+{
+    int rows = viewport()->height() / fontMetrics().height();
+    qint64 lines = indexed ? index.lines : 0;
+    verticalScrollBar()->setRange(0, int(qMin<qint64>(qMax<qint64>(0, lines - rows), INT_MAX)));
+    verticalScrollBar()->setPageStep(rows);
+}
+
+void LargeFileView::updateWindow()
+{
+    int rows = viewport()->height() / fontMetrics().height() + 1;
+    windowFirst = verticalScrollBar()->value();
+    window.resize(0);
+    windowOffsets.resize(0);
+    int columns = 0;
+    if (data) {
+        qint64 offset = lineOffset(windowFirst);
+        for (int row = 0; row < rows && offset <= size; row++) {
+            qint64 end = lineEnd(offset);
+            qint64 length = end - offset;
+            if (length > 0 && data[end - 1] == '\r')
+                length--;
+            length = qMin<qint64>(length, maxLineBytes);
+            window.append(QString::fromUtf8(reinterpret_cast<const char *>(data) + offset, int(length)));
+            windowOffsets.append(offset);
+            columns = qMax(columns, window.last().size());
+            offset = end + 1;
+        }
+    }
+    int width = columns * fontMetrics().horizontalAdvance(QLatin1Char('9')) + gutterWidth();
+    horizontalScrollBar()->setRange(0, qMax(0, width - viewport()->width()));
+    horizontalScrollBar()->setPageStep(viewport()->width());
+}
+
+void LargeFileView::paintEvent(QPaintEvent *)
+{
+    QPainter painter(viewport());
+    int height = fontMetrics().height();
+    int gutter = gutterWidth();
+    int x = gutter - horizontalScrollBar()->value();
+    for (int row = 0; row < window.size(); row++) {
+        int top = row * height;
+        qint64 offset = windowOffsets.at(row);
+        if (matchOffset >= offset && matchOffset - offset < maxLineBytes && matchOffset < lineEnd(offset)) {
+            int column = QString::fromUtf8(reinterpret_cast<const char *>(data) + offset, int(matchOffset - offset)).size();
+            int left = x + fontMetrics().horizontalAdvance(window.at(row).left(column));
+            int width = fontMetrics().horizontalAdvance(QString::fromUtf8(pattern));
+            painter.fillRect(left, top, width, height, QColor(90, 90, 40));
+        }
+        painter.setPen(Qt::lightGray);
+        painter.drawText(x, top, viewport()->width() - x + horizontalScrollBar()->value(), height,
+                         Qt::AlignLeft | Qt::TextExpandTabs, window.at(row));
+    }
+    painter.fillRect(0, 0, gutter, viewport()->height(), QColor(51, 51, 51));
+    painter.setPen(Qt::lightGray);
+    for (int row = 0; row < window.size(); row++)
+        painter.drawText(-(2+fontMetrics().horizontalAdvance(QLatin1Char('9'))), row * height, gutter, height,
+                         Qt::AlignRight, QString::number(windowFirst + row + 1));
+}
+
+void LargeFileView::resizeEvent(QResizeEvent *event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    updateRanges();
+    updateWindow();
+}
+
+void LargeFileView::scrollContentsBy(int, int dy)
+{
+    if (dy)
+        updateWindow();
+    viewport()->update();
+}
+
+void LargeFileView::keyPressEvent(QKeyEvent *event)
+{
+    if (event->matches(QKeySequence::Find)) {
+        bool ok;
+        QString text = QInputDialog::getText(this, tr("Find"), tr("Find:"), QLineEdit::Normal,
+                                             QString::fromUtf8(pattern), &ok);
+        if (ok)
+            find(text);
+    } else if (event->matches(QKeySequence::FindNext)) {
+        findNext();
+    } else if (event->matches(QKeySequence::MoveToStartOfDocument)) {
+        verticalScrollBar()->setValue(0);
+    } else if (event->matches(QKeySequence::MoveToEndOfDocument)) {
+        verticalScrollBar()->setValue(verticalScrollBar()->maximum());
+    } else {
+        QAbstractScrollArea::keyPressEvent(event);
+    }
+}
@@ -0,0 +1,99 @@
+/* Copyright (c) 2021, sarutora
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef LARGEFILEVIEW_H
+#define LARGEFILEVIEW_H
+
+#include <QAbstractScrollArea>
+#include <QAtomicInt>
+#include <QFile>
+#include <QFutureWatcher>
+#include <QVector>
+
+struct LineIndex
+{
+    QVector<qint64> checkpoints;
+    int stride;
+    qint64 lines;
+};
+
+// A read-only view of a memory-mapped file. Line offsets are indexed in the
+// background, keeping one checkpoint every `stride` lines and doubling the
+// stride when there are too many, so memory stays bounded however large the
+// file is; only the visible lines are ever decoded.
+class LargeFileView : public QAbstractScrollArea
+{
+    Q_OBJECT
+
+public:
+    explicit LargeFileView(const QString &path, QWidget *parent = nullptr);
+    ~LargeFileView();
+
+    bool isMapped() const;
+    void find(const QString &text);
+    void findNext();
+    void gotoLine(qint64 line);
+    QString filePath;
+    QString fileName;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+    void scrollContentsBy(int dx, int dy) override;
+
+private slots:
+    void indexingFinished();
+    void searchFinished();
+
+private:
+    qint64 lineOffset(qint64 line) const;
+    qint64 lineEnd(qint64 offset) const;
+    qint64 lineAt(qint64 offset) const;
+    void updateRanges();
+    void updateWindow();
+    int gutterWidth() const;
+
+    QFile file;
+    const uchar *data = nullptr;
+    qint64 size = 0;
+    LineIndex index;
+    bool indexed = false;
+    QAtomicInt cancelled;
+    QFutureWatcher<LineIndex> *watcher;
+
+    qint64 windowFirst = 0;
+    QVector<QString> window;
+    QVector<qint64> windowOffsets;
+    QByteArray pattern;
+    qint64 matchOffset = -1;
+    QFutureWatcher<qint64> *searchWatcher;
+    QByteArray searching;
+    bool searchQueued = false;
+};
+
+#endif // LARGEFILEVIEW_H
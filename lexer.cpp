@@ -0,0 +1,440 @@
+/* Copyright (c) 2021, sarutora
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "lexer.h"
+
+#include <QHash>
+
+namespace {
+
+struct Keyword
+{
+    const char *word;
+    TokenKind kind;
+    bool declaration;
+};
+
+// Sorted by byte value for the binary search in findKeyword.
+const Keyword keywords[] = {
+    {"Clone", TokenKind::type, false}, {"Copy", TokenKind::type, false},
+    {"Debug", TokenKind::type, false}, {"Self", TokenKind::type, false},
+    {"String", TokenKind::type, false}, {"Vec", TokenKind::type, false},
+    {"as", TokenKind::keyword, false}, {"async", TokenKind::keyword, false},
+    {"await", TokenKind::keyword, false}, {"bool", TokenKind::type, false},
+    {"break", TokenKind::keyword, false}, {"char", TokenKind::type, false},
+    {"const", TokenKind::keyword, false}, {"continue", TokenKind::keyword, false},
+    {"crate", TokenKind::keyword, false}, {"dyn", TokenKind::keyword, false},
+    {"else", TokenKind::keyword, false}, {"enum", TokenKind::keyword, true},
+    {"extern", TokenKind::keyword, false}, {"f32", TokenKind::type, false},
+    {"f64", TokenKind::type, false}, {"false", TokenKind::literal, false},
+    {"fn", TokenKind::keyword, true}, {"for", TokenKind::keyword, false},
+    {"i128", TokenKind::type, false}, {"i16", TokenKind::type, false},
+    {"i32", TokenKind::type, false}, {"i64", TokenKind::type, false},
+    {"i8", TokenKind::type, false}, {"if", TokenKind::keyword, false},
+    {"impl", TokenKind::keyword, false}, {"in", TokenKind::keyword, false},
+    {"isize", TokenKind::type, false}, {"let", TokenKind::keyword, false},
+    {"loop", TokenKind::keyword, false}, {"match", TokenKind::keyword, false},
+    {"mod", TokenKind::keyword, false}, {"move", TokenKind::type, false},
+    {"mut", TokenKind::type, false}, {"pub", TokenKind::keyword, false},
+    {"ref", TokenKind::keyword, false}, {"return", TokenKind::keyword, false},
+    {"self", TokenKind::literal, false}, {"static", TokenKind::keyword, false},
+    {"str", TokenKind::type, false}, {"struct", TokenKind::keyword, true},
+    {"super", TokenKind::keyword, false}, {"trait", TokenKind::keyword, true},
+    {"true", TokenKind::literal, false}, {"type", TokenKind::keyword, false},
+    {"u128", TokenKind::type, false}, {"u16", TokenKind::type, false},
+    {"u32", TokenKind::type, false}, {"u64", TokenKind::type, false},
+    {"u8", TokenKind::type, false}, {"union", TokenKind::keyword, false},
+    {"unsafe", TokenKind::keyword, false}, {"use", TokenKind::keyword, false},
+    {"usize", TokenKind::type, false}, {"where", TokenKind::keyword, false},
+    {"while", TokenKind::keyword, false}
+};
+
+const int keywordCount = sizeof(keywords) / sizeof(keywords[0]);
+const int longestKeyword = 8;
+
+int compare(const QChar *text, int length, const char *word)
+{
+    for (int i = 0; i < length; i++) {
+        if (!word[i])
+            return 1;
+        int d = text[i].unicode() - uchar(word[i]);
+        if (d)
+            return d;
+    }
+    return word[length] ? -1 : 0;
+}
+
+const Keyword *findKeyword(const QChar *text, int length)
+{
+    if (length > longestKeyword)
+        return nullptr;
+    int low = 0;
+    int high = keywordCount - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        int d = compare(text, length, keywords[middle].word);
+        if (d == 0)
+            return &keywords[middle];
+        if (d < 0)
+            high = middle - 1;
+        else
+            low = middle + 1;
+    }
+    return nullptr;
+}
+
+bool isIdentifierStart(ushort c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (c >= 0x80 && QChar(c).isLetter());
+}
+
+bool isIdentifier(ushort c)
+{
+    return isIdentifierStart(c) || (c >= '0' && c <= '9');
+}
+
+bool isDigit(ushort c)
+{
+    return c >= '0' && c <= '9';
+}
+
+}
+
+ushort RustLexer::at(int index) const
+{
+    return index < n ? s[index].unicode() : 0;
+}
+
+void RustLexer::add(int start, int length, TokenKind kind)
+{
+    if (length > 0)
+        tokens.append({start, length, kind});
+}
+
+int RustLexer::lex(const QString &text, int state)
+{
+    tokens.resize(0);
+    brackets.resize(0);
+    s = text.constData();
+    n = text.size();
+    i = 0;
+    endState = code;
+    declaration = false;
+    if (state > 0) {
+        int open = state & 3;
+        if (open == blockComment) {
+            if (!lexComment(0, state >> 3, state & 4))
+                return endState;
+        } else {
+            brackets.append({'\'', 0});
+            if (!lexString(0, state >> 3, open == rawString))
+                return endState;
+        }
+    }
+    while (i < n) {
+        ushort c = s[i].unicode();
+        ushort next = at(i + 1);
+        if (c == ' ' || c == '\t') {
+            i++;
+            continue;
+        }
+        if (isIdentifierStart(c)) {
+            if ((c == 'r' || (c == 'b' && next == 'r')) && (at(i + 1 + (c == 'b')) == '"' || at(i + 1 + (c == 'b')) == '#')) {
+                int start = i;
+                i += c == 'b' ? 2 : 1;
+                int hashes = 0;
+                while (at(i) == '#') {
+                    hashes++;
+                    i++;
+                }
+                if (at(i) == '"') {
+                    brackets.append({'\'', start});
+                    i++;
+                    if (!lexString(start, hashes, true))
+                        return endState;
+                    declaration = false;
+                    continue;
+                }
+                i = start;
+            } else if (c == 'b' && next == '"') {
+                brackets.append({'\'', i});
+                int start = i;
+                i += 2;
+                if (!lexString(start, 0, false))
+                    return endState;
+                declaration = false;
+                continue;
+            } else if (c == 'b' && next == '\'') {
+                i++;
+                lexQuote();
+                declaration = false;
+                continue;
+            }
+            lexIdentifier();
+            continue;
+        }
+        declaration = false;
+        if (c == '/' && next == '/') {
+            ushort third = at(i + 2);
+            bool doc = (third == '/' && at(i + 3) != '/') || third == '!';
+            add(i, n - i, doc ? TokenKind::docComment : TokenKind::comment);
+            break;
+        }
+        if (c == '/' && next == '*') {
+            ushort third = at(i + 2);
+            bool doc = (third == '*' && at(i + 3) != '*' && at(i + 3) != '/') || third == '!';
+            int start = i;
+            i += 2;
+            if (!lexComment(start, 1, doc))
+                return endState;
+            continue;
+        }
+        if (c == '#' && (next == '[' || (next == '!' && at(i + 2) == '['))) {
+            add(i, n - i, TokenKind::attribute);
+            break;
+        }
+        if (c == '"') {
+            brackets.append({'\'', i});
+            int start = i;
+            i++;
+            if (!lexString(start, 0, false))
+                return endState;
+            continue;
+        }
+        if (c == '\'') {
+            lexQuote();
+            continue;
+        }
+        if (isDigit(c)) {
+            lexNumber();
+            continue;
+        }
+        switch (c) {
+        case '(': case ')': case '[': case ']': case '{': case '}':
+            brackets.append({char(c), i});
+            break;
+        case ':':
+            if (next == ':') {
+                add(i, 2, TokenKind::separator);
+                i++;
+            }
+            break;
+        case '&':
+            add(i, 1, isIdentifier(next) || next == '\'' ? TokenKind::type : TokenKind::keyword);
+            break;
+        case '*':
+            add(i, 1, TokenKind::type);
+            break;
+        case '|': case '=': case '+': case '-': case '<': case '>': case '!':
+            add(i, 1, TokenKind::keyword);
+            break;
+        default:
+            break;
+        }
+        i++;
+    }
+    return endState;
+}
+
+// Called with i just past the opening quote. Escapes other than \n, \r and
+// \t are shown as plain text, as before.
+bool RustLexer::lexString(int start, int hashes, bool raw)
+{
+    int run = start;
+    while (i < n) {
+        ushort c = s[i].unicode();
+        if (!raw && c == '\\') {
+            if (i + 1 >= n) {
+                i++;
+                break;
+            }
+            add(run, i - run, TokenKind::string);
+            ushort e = s[i + 1].unicode();
+            int length = 2;
+            if (e == 'u' && at(i + 2) == '{') {
+                while (i + length < n && s[i + length] != '}')
+                    length++;
+                length = qMin(length + 1, n - i);
+            } else if (e == 'x') {
+                length = qMin(4, n - i);
+            }
+            add(i, length, e == 'n' || e == 'r' || e == 't' ? TokenKind::escape : TokenKind::plain);
+            i += length;
+            run = i;
+            continue;
+        }
+        if (c == '"') {
+            int closing = 0;
+            while (closing < hashes && at(i + 1 + closing) == '#')
+                closing++;
+            if (closing == hashes) {
+                add(run, i + 1 + hashes - run, TokenKind::string);
+                brackets.append({'"', i});
+                i += 1 + hashes;
+                return true;
+            }
+        }
+        i++;
+    }
+    add(run, n - run, TokenKind::string);
+    endState = raw ? rawString | hashes << 3 : string;
+    return false;
+}
+
+bool RustLexer::lexComment(int start, int depth, bool doc)
+{
+    while (i < n) {
+        ushort c = s[i].unicode();
+        ushort next = at(i + 1);
+        if (c == '/' && next == '*') {
+            depth++;
+            i += 2;
+        } else if (c == '*' && next == '/') {
+            i += 2;
+            if (--depth == 0) {
+                add(start, i - start, doc ? TokenKind::docComment : TokenKind::comment);
+                return true;
+            }
+        } else {
+            i++;
+        }
+    }
+    add(start, n - start, doc ? TokenKind::docComment : TokenKind::comment);
+    endState = blockComment | (doc ? 4 : 0) | depth << 3;
+    return false;
+}
+
+// A quote starts either a character literal or a lifetime.
+void RustLexer::lexQuote()
+{
+    int start = i;
+    ushort next = at(i + 1);
+    if (next == '\\') {
+        int end = i + 3;
+        while (end < n && end - start < 12 && s[end] != '\'')
+            end++;
+        if (at(end) == '\'') {
+            add(start, end + 1 - start, TokenKind::literal);
+            i = end + 1;
+            return;
+        }
+    } else if (next && at(i + 2) == '\'') {
+        add(start, 3, TokenKind::literal);
+        i += 3;
+        return;
+    } else if (QChar::isHighSurrogate(next) && at(i + 3) == '\'') {
+        add(start, 4, TokenKind::literal);
+        i += 4;
+        return;
+    }
+    if (isIdentifier(next)) {
+        int end = i + 1;
+        while (end < n && isIdentifier(s[end].unicode()))
+            end++;
+        add(start, end - start, TokenKind::lifetime);
+        i = end;
+        return;
+    }
+    i++;
+}
+
+void RustLexer::lexNumber()
+{
+    int start = i;
+    ushort base = at(i + 1);
+    if (s[i] == '0' && (base == 'x' || base == 'o' || base == 'b')) {
+        i += 2;
+        while (i < n && (isIdentifier(s[i].unicode())))
+            i++;
+    } else {
+        while (i < n && (isDigit(s[i].unicode()) || s[i] == '_'))
+            i++;
+        if (at(i) == '.' && isDigit(at(i + 1))) {
+            i++;
+            while (i < n && (isDigit(s[i].unicode()) || s[i] == '_'))
+                i++;
+        }
+        if ((at(i) == 'e' || at(i) == 'E')
+                && (isDigit(at(i + 1)) || ((at(i + 1) == '+' || at(i + 1) == '-') && isDigit(at(i + 2))))) {
+            i += 2;
+            while (i < n && (isDigit(s[i].unicode()) || s[i] == '_'))
+                i++;
+        }
+        while (i < n && isIdentifier(s[i].unicode()))
+            i++;
+    }
+    add(start, i - start, TokenKind::literal);
+}
+
+// Names are coloured by what follows them: a macro call, a path segment, a
+// function call, or the name in an fn, struct, enum or trait declaration.
+void RustLexer::lexIdentifier()
+{
+    int start = i;
+    while (i < n && isIdentifier(s[i].unicode()))
+        i++;
+    int length = i - start;
+    const Keyword *keyword = findKeyword(s + start, length);
+    if (keyword) {
+        add(start, length, keyword->kind);
+        declaration = keyword->declaration;
+        return;
+    }
+    ushort next = at(i);
+    if (next == '!' && at(i + 1) != '=') {
+        add(start, length + 1, TokenKind::macro);
+        i++;
+    } else if (next == ':' && at(i + 1) == ':') {
+        add(start, length, TokenKind::path);
+    } else if (next == '(' || declaration) {
+        add(start, length, TokenKind::function);
+    }
+    declaration = false;
+}
+
+LexedDocument lexDocument(const QString &text)
+{
+    LexedDocument document;
+    RustLexer lexer;
+    int state = -1;
+    const QChar *data = text.constData();
+    int size = text.size();
+    int start = 0;
+    while (start <= size) {
+        int end = start;
+        while (end < size && data[end] != '\n' && data[end] != '\r' && data[end] != QChar::ParagraphSeparator)
+            end++;
+        QString line = QString::fromRawData(data + start, end - start);
+        state = lexer.lex(line, state);
+        document.lines.append({line.size(), qHash(line), state, document.tokens.size(), document.brackets.size()});
+        document.tokens += lexer.tokens;
+        document.brackets += lexer.brackets;
+        if (end + 1 < size && data[end] == '\r' && data[end + 1] == '\n')
+            end++;
+        start = end + 1;
+    }
+    return document;
+}
@@ -0,0 +1,110 @@
+/* Copyright (c) 2021, sarutora
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <QString>
+#include <QVector>
+
+struct BracketInfo
+{
+    char character;
+    int position;
+};
+
+Q_DECLARE_TYPEINFO(BracketInfo, Q_PRIMITIVE_TYPE);
+
+enum class TokenKind {
+    plain, keyword, type, literal, string, escape, comment, docComment,
+    attribute, lifetime, function, path, separator, macro
+};
+
+struct Token
+{
+    int start;
+    int length;
+    TokenKind kind;
+};
+
+Q_DECLARE_TYPEINFO(Token, Q_PRIMITIVE_TYPE);
+
+// Splits one line of Rust into tokens and brackets in a single pass. The
+// returned state carries open strings, raw strings and nested block
+// comments into the next line: the low two bits hold what is open, bit 2
+// marks doc comments and the rest is the raw string's hash count or the
+// comment depth.
+class RustLexer
+{
+public:
+    enum State { code = 0, string = 1, rawString = 2, blockComment = 3 };
+
+    int lex(const QString &text, int state);
+
+    QVector<Token> tokens;
+    QVector<BracketInfo> brackets;
+
+private:
+    bool lexString(int start, int hashes, bool raw);
+    bool lexComment(int start, int depth, bool doc);
+    void lexQuote();
+    void lexNumber();
+    void lexIdentifier();
+    void add(int start, int length, TokenKind kind);
+    ushort at(int index) const;
+
+    const QChar *s = nullptr;
+    int n = 0;
+    int i = 0;
+    int endState = 0;
+    bool declaration = false;
+};
+
+struct LexedLine
+{
+    int length;
+    uint hash;
+    int state;
+    int firstToken;
+    int firstBracket;
+};
+
+Q_DECLARE_TYPEINFO(LexedLine, Q_PRIMITIVE_TYPE);
+
+// Lexing results for a whole text, kept in flat arrays with per-line
+// offsets. Lines are split the way QTextDocument splits blocks; each keeps
+// its length and hash so a block can tell whether it was edited since.
+struct LexedDocument
+{
+    QVector<LexedLine> lines;
+    QVector<Token> tokens;
+    QVector<BracketInfo> brackets;
+};
+
+LexedDocument lexDocument(const QString &text);
+
+#endif // LEXER_H
@@ -26,132 +26,1029 @@
 
 #include "lsp.h"
 
-Client::Client(QObject *parent, int pid, QString dirName): dirName(dirName), parent(parent), pid(pid), rootUri("file://" + dirName), cv(2048) {
-    lengthExpression = QRegularExpression("Content-Length: ");
-    terminateExpression = QRegularExpression("\r\n\r\n");
-    start();
+#include <QProcessEnvironment>
+#include <QStandardPaths>
+#include <QFileInfo>
+#include <QDir>
+#include <QWidget>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+Framer::Framer(): buffer(2048, Qt::Uninitialized) {
+}
+
+char *Framer::reserve(int size) {
+    if (head > 0 && (head == tail || buffer.size() - tail < size)) {
+        memmove(buffer.data(), buffer.constData() + head, tail - head);
+        tail -= head;
+        scanned -= head;
+        head = 0;
+    }
+    if (buffer.size() - tail < size)
+        buffer.resize(qMax(tail + size, buffer.size() * 2));
+    return buffer.data() + tail;
+}
+
+void Framer::commit(int size) {
+    tail += size;
+}
+
+// The returned message points into the receive buffer and is only valid
+// until the next call to reserve().
+bool Framer::next(QByteArray &message) {
+    if (length == -1 && !parseHeader())
+        return false;
+    if (tail - head < length)
+        return false;
+    message = QByteArray::fromRawData(buffer.constData() + head, length);
+    head += length;
+    scanned = head;
+    length = -1;
+    return true;
+}
+
+bool Framer::parseHeader() {
+    const char *data = buffer.constData();
+    int end = -1;
+    for (int i = qMax(scanned, head); i + 3 < tail; i++) {
+        const void *cr = memchr(data + i, '\r', tail - i - 3);
+        if (!cr)
+            break;
+        i = static_cast<const char *>(cr) - data;
+        if (data[i+1] == '\n' && data[i+2] == '\r' && data[i+3] == '\n') {
+            end = i;
+            break;
+        }
+    }
+    if (end == -1) {
+        scanned = qMax(head, tail - 3);
+        return false;
+    }
+    static const char field[] = "content-length:";
+    static const int fieldSize = sizeof(field) - 1;
+    qint64 contentLength = -1;
+    int line = head;
+    while (line < end) {
+        int eol = line;
+        while (eol < end && data[eol] != '\r')
+            eol++;
+        if (eol - line > fieldSize && qstrnicmp(data + line, field, fieldSize) == 0) {
+            int i = line + fieldSize;
+            while (i < eol && data[i] == ' ')
+                i++;
+            contentLength = 0;
+            for (; i < eol && data[i] >= '0' && data[i] <= '9'; i++) {
+                contentLength = contentLength * 10 + (data[i] - '0');
+                if (contentLength > INT_MAX)
+                    throw "Error parsing response";
+            }
+        }
+        line = eol + 2;
+    }
+    if (contentLength < 0)
+        throw "Error parsing response";
+    head = end + 4;
+    scanned = head;
+    length = contentLength;
+    return true;
+}
+
+JsonWriter::JsonWriter() {
+    body.reserve(4096);
+    framed.reserve(4096);
+}
+
+void JsonWriter::clear() {
+    body.resize(0);
+}
+
+void JsonWriter::raw(const char *text) {
+    body.append(text);
+}
+
+void JsonWriter::raw(const QByteArray &text) {
+    body.append(text);
+}
+
+// Encodes UTF-16 to UTF-8 in place; six bytes per code unit covers the
+// longest escape.
+void JsonWriter::string(const QString &text) {
+    static const char hex[] = "0123456789abcdef";
+    int size = body.size();
+    body.resize(size + text.size() * 6 + 2);
+    char *out = body.data() + size;
+    *out++ = '"';
+    const ushort *in = text.utf16();
+    const ushort *end = in + text.size();
+    while (in < end) {
+        uint c = *in++;
+        if (c == '"' || c == '\\') {
+            *out++ = '\\';
+            *out++ = char(c);
+        } else if (c >= 0x20 && c < 0x80) {
+            *out++ = char(c);
+        } else if (c == '\n') {
+            *out++ = '\\';
+            *out++ = 'n';
+        } else if (c == '\r') {
+            *out++ = '\\';
+            *out++ = 'r';
+        } else if (c == '\t') {
+            *out++ = '\\';
+            *out++ = 't';
+        } else if (c < 0x800) {
+            if (c < 0x20) {
+                *out++ = '\\';
+                *out++ = 'u';
+                *out++ = '0';
+                *out++ = '0';
+                *out++ = hex[c >> 4];
+                *out++ = hex[c & 0xf];
+            } else {
+                *out++ = char(0xc0 | (c >> 6));
+                *out++ = char(0x80 | (c & 0x3f));
+            }
+        } else if (QChar::isHighSurrogate(c) && in < end && QChar::isLowSurrogate(*in)) {
+            uint code = QChar::surrogateToUcs4(ushort(c), *in++);
+            *out++ = char(0xf0 | (code >> 18));
+            *out++ = char(0x80 | ((code >> 12) & 0x3f));
+            *out++ = char(0x80 | ((code >> 6) & 0x3f));
+            *out++ = char(0x80 | (code & 0x3f));
+        } else if (QChar::isSurrogate(c)) {
+            *out++ = '\\';
+            *out++ = 'u';
+            *out++ = hex[c >> 12];
+            *out++ = hex[(c >> 8) & 0xf];
+            *out++ = hex[(c >> 4) & 0xf];
+            *out++ = hex[c & 0xf];
+        } else {
+            *out++ = char(0xe0 | (c >> 12));
+            *out++ = char(0x80 | ((c >> 6) & 0x3f));
+            *out++ = char(0x80 | (c & 0x3f));
+        }
+    }
+    *out++ = '"';
+    body.resize(out - body.constData());
+}
+
+void JsonWriter::number(qint64 n) {
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    quint64 u = n < 0 ? 0 - quint64(n) : quint64(n);
+    do {
+        *--p = char('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (n < 0)
+        *--p = '-';
+    body.append(p, int(digits + sizeof(digits) - p));
+}
+
+void JsonWriter::position(int line, int character) {
+    raw("{\"line\":");
+    number(line);
+    raw(",\"character\":");
+    number(character);
+    raw("}");
+}
+
+// The frame is shared with the worker thread; it is only reallocated if the
+// worker still holds the previous one when the next message is written.
+const QByteArray &JsonWriter::frame() {
+    framed.resize(0);
+    framed.append("Content-Length: ");
+    char digits[12];
+    char *p = digits + sizeof(digits);
+    int n = body.size();
+    do {
+        *--p = char('0' + n % 10);
+        n /= 10;
+    } while (n);
+    framed.append(p, int(digits + sizeof(digits) - p));
+    framed.append("\r\n\r\n");
+    framed.append(body);
+    return framed;
+}
+
+Message Message::fromJson(const QJsonObject &object) {
+    Message message;
+    message.object = object;
+    message.method = object.value("method").toString();
+    if (object.contains("id"))
+        message.id = object.value("id").toInt(-1);
+    if (message.method.isEmpty())
+        message.kind = Kind::response;
+    else if (object.contains("id"))
+        message.kind = Kind::request;
+    QJsonObject params = object.value("params").toObject();
+    message.uri = params.value("uri").toString();
+    if (message.uri.isEmpty())
+        message.uri = params.value("textDocument").toObject().value("uri").toString();
+    return message;
+}
+
+void ClientWorker::start(const QString &program, const QStringList &arguments) {
+    closeProcess();
+    framer = Framer();
+    outbox.clear();
+    inFlight = false;
+    process = new QProcess(this);
+    process->setProgram(program);
+    process->setArguments(arguments);
+    connect(process, &QProcess::readyReadStandardOutput, this, &ClientWorker::readOutput);
+    connect(process, &QProcess::errorOccurred, this, &ClientWorker::processError);
+    connect(process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, &ClientWorker::finished);
+    if (!process->open())
+        emit failed();
+}
+
+static const quint32 logMagic = 0x4f584c53;
+static const quint16 logVersion = 1;
+
+// A log is a header followed by one record per message: direction ('>'
+// sent, '<' received), nanoseconds since recording started and the JSON
+// body without its Content-Length header.
+void ClientWorker::record(const QString &path) {
+    if (log.isOpen())
+        return;
+    log.setFileName(path);
+    if (!log.open(QFile::WriteOnly | QFile::Truncate)) {
+        std::cerr << "Error opening LSP log " << path.toStdString() << "\n";
+        return;
+    }
+    logStream.setDevice(&log);
+    logStream.setVersion(QDataStream::Qt_5_0);
+    logStream << logMagic << logVersion;
+    logClock.start();
+}
+
+void ClientWorker::store(char direction, const char *data, int size) {
+    if (!log.isOpen())
+        return;
+    logStream << quint8(direction) << qint64(logClock.nsecsElapsed());
+    logStream.writeBytes(data, size);
+}
+
+// Replays the received half of a log as fast as the GUI acknowledges it.
+// Replies are matched to the live session's requests by method and order,
+// since the ids of the recorded session mean nothing here.
+void ClientWorker::replay(const QString &path) {
+    closeProcess();
+    framer = Framer();
+    outbox.clear();
+    inFlight = false;
+    records.clear();
+    recordedIds.clear();
+    liveIds.clear();
+    replayed = 0;
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) {
+        emit failed();
+        return;
+    }
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic;
+    quint16 version;
+    in >> magic >> version;
+    if (magic != logMagic || version != logVersion) {
+        emit failed();
+        return;
+    }
+    QHash<QString, int> counts;
+    while (!in.atEnd()) {
+        quint8 direction;
+        qint64 time;
+        QByteArray body;
+        in >> direction >> time >> body;
+        if (in.status() != QDataStream::Ok)
+            break;
+        if (direction == '<') {
+            records.append(body);
+            continue;
+        }
+        QJsonObject o = QJsonDocument::fromJson(body).object();
+        if (o.contains("id") && o.contains("method")) {
+            QString method = o.value("method").toString();
+            recordedIds.insert(o.value("id").toInt(), qMakePair(method, counts[method]++));
+        }
+    }
+    replayIndex = 0;
+    QTimer::singleShot(0, this, &ClientWorker::replayNext);
+}
+
+void ClientWorker::replayNext() {
+    if (replayIndex < 0 || inFlight)
+        return;
+    while (replayIndex < records.size()) {
+        const QByteArray &body = records.at(replayIndex++);
+        QElapsedTimer timer;
+        timer.start();
+        QByteArray header = "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n";
+        int size = header.size() + body.size();
+        char *data = framer.reserve(size);
+        memcpy(data, header.constData(), header.size());
+        memcpy(data + header.size(), body.constData(), body.size());
+        framer.commit(size);
+        QByteArray frame;
+        if (!framer.next(frame))
+            continue;
+        Message message = Message::fromJson(QJsonDocument::fromJson(frame).object());
+        if (message.kind == Message::Kind::response) {
+            auto it = recordedIds.constFind(message.id);
+            if (it == recordedIds.constEnd())
+                continue;
+            const QVector<int> &live = liveIds[it->first];
+            if (it->second >= live.size())
+                continue;
+            message.id = live.at(it->second);
+            message.object.insert("id", message.id);
+        }
+        message.parseTime = timer.nsecsElapsed();
+        replayed++;
+        post(message);
+        flush();
+        return;
+    }
+    replayIndex = -1;
+    emit replayFinished(replayed);
+}
+
+void ClientWorker::write(const QByteArray &data) {
+    int body = data.indexOf("\r\n\r\n") + 4;
+    store('>', data.constData() + body, data.size() - body);
+    if (replayIndex >= 0) {
+        QJsonObject o = QJsonDocument::fromJson(QByteArray::fromRawData(data.constData() + body, data.size() - body)).object();
+        if (o.contains("id") && o.contains("method"))
+            liveIds[o.value("method").toString()].append(o.value("id").toInt());
+        return;
+    }
+    if (!process || process->state() == QProcess::NotRunning)
+        return;
+    if (process->write(data) == -1)
+        std::cerr << "Error sending request\n";
+}
+
+void ClientWorker::readOutput() {
+    try {
+        qint64 available = process->bytesAvailable();
+        while (available > 0) {
+            int size = static_cast<int>(qMin<qint64>(available, 1 << 20));
+            qint64 n = process->read(framer.reserve(size), size);
+            if (n <= 0)
+                break;
+            framer.commit(n);
+            QByteArray body;
+            while (framer.next(body)) {
+                QElapsedTimer timer;
+                timer.start();
+                store('<', body.constData(), body.size());
+                QJsonObject o = QJsonDocument::fromJson(body).object();
+                if (o.empty())
+                    throw "Error parsing response";
+                Message message = Message::fromJson(o);
+                message.parseTime = timer.nsecsElapsed();
+                post(message);
+            }
+            available = process->bytesAvailable();
+        }
+    } catch (const char *msg) {
+        std::cerr << msg << '\n';
+        framer = Framer();
+    }
+    flush();
+}
+
+// Only one batch is handed to the GUI thread at a time. Whatever arrives
+// meanwhile waits here, and diagnostics for the same document replace
+// each other instead of queueing up.
+void ClientWorker::post(const Message &message) {
+    if (message.method == "textDocument/publishDiagnostics") {
+        for (auto &waiting: outbox) {
+            if (waiting.method == message.method && waiting.uri == message.uri) {
+                waiting = message;
+                return;
+            }
+        }
+    }
+    outbox.append(message);
+}
+
+void ClientWorker::flush() {
+    if (inFlight || outbox.isEmpty())
+        return;
+    inFlight = true;
+    QVector<Message> batch;
+    batch.swap(outbox);
+    emit received(batch);
+}
+
+void ClientWorker::acknowledge() {
+    inFlight = false;
+    flush();
+    if (replayIndex >= 0 && !inFlight)
+        QTimer::singleShot(0, this, &ClientWorker::replayNext);
+}
+
+void ClientWorker::processError(QProcess::ProcessError error) {
+    if (error == QProcess::FailedToStart)
+        emit failed();
+}
+
+void ClientWorker::stop() {
+    if (process && process->state() != QProcess::NotRunning) {
+        process->waitForBytesWritten(1000);
+        process->closeWriteChannel();
+        process->waitForFinished(1000);
+    }
+    closeProcess();
+    log.close();
+    thread()->quit();
+}
+
+void ClientWorker::closeProcess() {
+    if (!process)
+        return;
+    process->disconnect(this);
+    delete process;
+    process = nullptr;
+}
+
+Dispatcher::Dispatcher(Client *client): QObject(client), client(client) {
+}
+
+void Dispatcher::attach(const QString &uri, QObject *owner, Handler handler) {
+    subscribers.insert(uri, {owner, handler});
+}
+
+void Dispatcher::detach(const QString &uri) {
+    subscribers.remove(uri);
+}
+
+void Dispatcher::dispatch() {
+    for (const auto &message: client->getResponses()) {
+        QElapsedTimer timer;
+        timer.start();
+        QString method = message.method;
+        QObject *owner = nullptr;
+        auto it = subscribers.constFind(message.uri);
+        if (message.kind == Message::Kind::response) {
+            method = client->requestMethod(message.id);
+            owner = client->requestOwner(message.id);
+            client->dispatch(message);
+        } else if (it != subscribers.constEnd() && it->owner) {
+            owner = it->owner;
+            it->handler(message);
+        } else if (message.method == "workspace/configuration") {
+            QJsonArray settings;
+            int items = message.object.value("params").toObject().value("items").toArray().size();
+            for (int i = 0; i < items; i++)
+                settings.append(QJsonObject());
+            client->reply(message.object.value("id"), settings);
+        } else if (message.kind == Message::Kind::request) {
+            client->reply(message.object.value("id"), QJsonValue::Null);
+        }
+        qint64 dispatched = timer.nsecsElapsed();
+        qint64 rendered = 0;
+        QWidget *widget = qobject_cast<QWidget *>(owner);
+        if (client->replaying && widget) {
+            timer.restart();
+            widget->repaint();
+            rendered = timer.nsecsElapsed();
+        }
+        if (!method.isEmpty())
+            client->recordTiming(method, message.parseTime, dispatched, rendered);
+    }
+}
+
+// rust-analyzer is preferred; RLS is deprecated and only used when it is
+// the sole server installed. OXIDE_LSP_SERVER overrides both.
+ServerBackend ServerBackend::find() {
+    QVector<ServerBackend> backends;
+    backends.append({"rust-analyzer", "rust-analyzer", QStringList(), false});
+    backends.append({"rls", "rls", QStringList(), true});
+    QStringList args = QProcess::splitCommand(QProcessEnvironment::systemEnvironment().value("OXIDE_LSP_SERVER"));
+    if (!args.isEmpty()) {
+        QString program = args.takeFirst();
+        QString name = program.mid(program.lastIndexOf('/') + 1);
+        for (const auto &backend: backends) {
+            if (backend.name == name)
+                return {name, program, args, backend.awaitsRegistration};
+        }
+        return {name, program, args, false};
+    }
+    for (const auto &backend: backends) {
+        if (!QStandardPaths::findExecutable(backend.program).isEmpty())
+            return backend;
+    }
+    return backends.first();
+}
+
+void ServerCapabilities::parse(const QJsonObject &capabilities) {
+    QJsonValue textDocumentSync = capabilities.value("textDocumentSync");
+    int change = textDocumentSync.isObject() ? textDocumentSync.toObject().value("change").toInt() : textDocumentSync.toInt();
+    sync = change == 2 ? Sync::incremental : change == 1 ? Sync::full : Sync::none;
+    auto provided = [&](const char *name) {
+        QJsonValue value = capabilities.value(name);
+        return value.isObject() || value.toBool();
+    };
+    hover = provided("hoverProvider");
+    completion = provided("completionProvider");
+    definition = provided("definitionProvider");
+    completionTriggers.clear();
+    for (const auto &trigger: capabilities.value("completionProvider").toObject().value("triggerCharacters").toArray())
+        completionTriggers << trigger.toString();
+    QJsonObject semanticTokens = capabilities.value("semanticTokensProvider").toObject();
+    QJsonValue full = semanticTokens.value("full");
+    semanticTokensFull = full.isObject() || full.toBool();
+    semanticTokensDelta = full.toObject().value("delta").toBool();
+    semanticTokensRange = semanticTokens.value("range").isObject() || semanticTokens.value("range").toBool();
+    tokenTypes.clear();
+    for (const auto &type: semanticTokens.value("legend").toObject().value("tokenTypes").toArray())
+        tokenTypes << type.toString();
+}
+
+static QJsonObject clientCapabilities() {
+    QJsonObject synchronization;
+    synchronization.insert("dynamicRegistration", false);
+    synchronization.insert("didSave", false);
+    QJsonObject completionItem;
+    completionItem.insert("snippetSupport", false);
+    QJsonObject completion;
+    completion.insert("completionItem", completionItem);
+    QJsonObject hover;
+    hover.insert("contentFormat", QJsonArray({"plaintext", "markdown"}));
+    QJsonObject definition;
+    definition.insert("linkSupport", true);
+    QJsonObject publishDiagnostics;
+    publishDiagnostics.insert("versionSupport", true);
+    QJsonObject full;
+    full.insert("delta", true);
+    QJsonObject requests;
+    requests.insert("range", true);
+    requests.insert("full", full);
+    QJsonObject semanticTokens;
+    semanticTokens.insert("requests", requests);
+    semanticTokens.insert("tokenTypes", QJsonArray({"namespace", "type", "class", "enum", "interface", "struct",
+                                                    "typeParameter", "parameter", "variable", "property",
+                                                    "enumMember", "function", "method", "macro", "keyword",
+                                                    "comment", "string", "number", "operator"}));
+    semanticTokens.insert("tokenModifiers", QJsonArray());
+    semanticTokens.insert("formats", QJsonArray({"relative"}));
+    QJsonObject textDocument;
+    textDocument.insert("synchronization", synchronization);
+    textDocument.insert("completion", completion);
+    textDocument.insert("hover", hover);
+    textDocument.insert("definition", definition);
+    textDocument.insert("publishDiagnostics", publishDiagnostics);
+    textDocument.insert("semanticTokens", semanticTokens);
+    QJsonObject workspace;
+    workspace.insert("configuration", true);
+    QJsonObject capabilities;
+    capabilities.insert("textDocument", textDocument);
+    capabilities.insert("workspace", workspace);
+    return capabilities;
+}
+
+Client::Client(QObject *parent, int pid, QString dirName): QObject(parent), dirName(dirName), pid(pid), rootUri("file://" + dirName) {
+    qRegisterMetaType<Message>("Message");
+    qRegisterMetaType<QVector<Message>>("QVector<Message>");
+    qRegisterMetaType<QProcess::ExitStatus>("QProcess::ExitStatus");
+    clock.start();
+    registrationTimer.setSingleShot(true);
+    registrationTimer.setInterval(10000);
+    connect(&registrationTimer, &QTimer::timeout, this, &Client::setReady);
+    dispatcher = new Dispatcher(this);
+    connect(this, &Client::readyRead, dispatcher, &Dispatcher::dispatch);
+    worker = new ClientWorker;
+    worker->moveToThread(&thread);
+    connect(worker, &ClientWorker::received, this, &Client::receive);
+    connect(worker, &ClientWorker::finished, this, &Client::processFinished);
+    restartTimer.setSingleShot(true);
+    connect(&restartTimer, &QTimer::timeout, this, &Client::restart);
+    connect(worker, &ClientWorker::replayFinished, this, [this](int messages) {
+        emit phaseChanged(tr("Replay finished after %1 messages").arg(messages));
+    });
+    connect(worker, &ClientWorker::failed, this, [this]() {
+        if (state != State::ready)
+            setState(State::failed);
+    });
+    thread.start();
 }
 
 void Client::start() {
-    idNumber = 0;
-    length = 0;
-    ls = new QProcess(parent);
-    ls->setProgram("rls");
-    if (!ls->open()) {
-        throw "Error starting rls";
+    pending.clear();
+    queued.clear();
+    restarts = 0;
+    keep = true;
+    launch();
+}
+void Client::launch() {
+    backlog.clear();
+    startTimer.start();
+    setState(State::starting);
+    backend = ServerBackend::find();
+    capabilities = ServerCapabilities();
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    QString logName = QFileInfo(dirName).fileName() + ".lsplog";
+    QString replayDir = environment.value("OXIDE_LSP_REPLAY");
+    QString recordDir = environment.value("OXIDE_LSP_RECORD");
+    replaying = !replayDir.isEmpty();
+    if (replaying) {
+        backend = {"replay", QString(), QStringList(), false};
+        QMetaObject::invokeMethod(worker, "replay", Qt::QueuedConnection,
+                                  Q_ARG(QString, QDir(replayDir).filePath(logName)));
+    } else {
+        if (!recordDir.isEmpty())
+            QMetaObject::invokeMethod(worker, "record", Qt::QueuedConnection,
+                                      Q_ARG(QString, QDir(recordDir).filePath(logName)));
+        QMetaObject::invokeMethod(worker, "start", Qt::QueuedConnection,
+                                  Q_ARG(QString, backend.program), Q_ARG(QStringList, backend.arguments));
     }
     QJsonObject params;
     params.insert("processId", pid);
     params.insert("rootUri", rootUri);
-    QJsonObject capabilities;
-    params.insert("capabilities", capabilities);
+    params.insert("capabilities", clientCapabilities());
     QJsonObject initRequest = createRequest("initialize", params);
-    sendRequest(initRequest);
-    bool initialized = false;
-    if (ls->waitForReadyRead()) {
-        QJsonObject initResponse = getResponses()[0];
-        if (initResponse.contains("result")) {
-            QJsonObject initNotification = createRequest("initialized", QJsonObject());
-            sendRequest(initNotification);
-            initialized = true;
-            QVector<QString> ids;
-            bool b = false;
-            while (ls->waitForReadyRead()) {
-                QVector<QJsonObject> responses = getResponses();
-                for (const auto &response: responses) {
-                    if (response.value("method") == "client/registerCapability") {
-                        b = true;
-                    }
-                }
-                if (b)
-                    break;
+    initId = initRequest.value("id").toInt();
+    write(initRequest);
+    setState(State::initializing);
+}
+
+void Client::receive(const QVector<Message> &messages) {
+    for (const auto &message: messages) {
+        if (state == State::initializing && message.kind == Message::Kind::response && message.id == initId) {
+            if (!message.object.contains("result")) {
+                std::cerr << "Error initializing " << backend.name.toStdString() << "\n";
+                setState(State::failed);
+                continue;
+            }
+            capabilities.parse(message.object.value("result").toObject().value("capabilities").toObject());
+            QJsonObject initNotification = createNotification("initialized", QJsonObject());
+            write(initNotification);
+            if (backend.awaitsRegistration) {
+                setState(State::registering);
+                registrationTimer.start();
+            } else {
+                setReady();
             }
+        } else if (state == State::registering && message.method == "client/registerCapability") {
+            reply(message.object.value("id"), QJsonValue::Null);
+            setReady();
+        } else {
+            if (recovering && state == State::ready && message.method == "textDocument/publishDiagnostics") {
+                recovering = false;
+                recoveryTime = recoveryClock.elapsed();
+                emit phaseChanged(tr("%1 recovered, diagnostics after %2 s").arg(backend.name, QString::number(recoveryTime / 1000.0, 'f', 2)));
+            }
+            backlog.append(message);
         }
     }
-    if (!initialized) {
-        throw "Error initializing rls";
+    if (state == State::ready && !backlog.isEmpty())
+        emit readyRead();
+    QMetaObject::invokeMethod(worker, "acknowledge", Qt::QueuedConnection);
+}
+
+void Client::setReady() {
+    if (state != State::initializing && state != State::registering)
+        return;
+    registrationTimer.stop();
+    readyTime = startTimer.elapsed();
+    setState(State::ready);
+    for (const auto &queuedFrame: queued)
+        writeFrame(queuedFrame.frame);
+    queued.clear();
+}
+
+// A failed or stopped server takes no more messages until it is started
+// again, so nothing is kept for it.
+void Client::setState(State s) {
+    state = s;
+    if (s == State::failed || s == State::stopped) {
+        queued.clear();
+        pending.clear();
+    }
+    emit phaseChanged(phase());
+}
+
+QString Client::phase() const {
+    QString elapsed = QString::number(startTimer.elapsed() / 1000.0, 'f', 2);
+    const QString &program = backend.name;
+    switch (state) {
+    case State::starting:
+        return tr("Starting %1").arg(program);
+    case State::initializing:
+        return tr("Initializing %1 (%2 s)").arg(program, elapsed);
+    case State::registering:
+        return tr("Waiting for %1 to register capabilities (%2 s)").arg(program, elapsed);
+    case State::ready:
+        return tr("%1 ready in %2 s").arg(program, QString::number(readyTime / 1000.0, 'f', 2));
+    case State::restarting:
+        return tr("%1 exited with code %2, restarting in %3 s").arg(program).arg(exitCode).arg(restartDelay / 1000.0, 0, 'f', 1);
+    case State::failed:
+        return tr("%1 failed to start").arg(program);
+    default:
+        return tr("%1 stopped").arg(program);
     }
 }
 
 Client::~Client() {
     keep = false;
-    if (ls) {
+    if (state == State::ready) {
         QJsonObject params;
         QJsonObject shutdownRequest = createRequest("shutdown", params);
-        sendRequest(shutdownRequest);
-                    QJsonObject exitNotification = createRequest("exit", QJsonObject());
-                    sendRequest(exitNotification);
-                        return;
+        write(shutdownRequest);
+        QJsonObject exitNotification = createNotification("exit", QJsonObject());
+        write(exitNotification);
     }
-    std::cerr <<  "Error shutting down rls\n";
+    QMetaObject::invokeMethod(worker, "stop", Qt::QueuedConnection);
+    thread.wait();
+    delete worker;
 }
 
-
+static QByteArray frameJson(const QJsonObject &message) {
+    QByteArray content = QJsonDocument(message).toJson(QJsonDocument::Compact);
+    return "Content-Length: " + QByteArray::number(content.size()) + "\r\n\r\n" + content;
+}
 void Client::sendRequest(const QJsonObject &request) {
-        QJsonDocument doc(request);
-        QByteArray content = doc.toJson(QJsonDocument::Compact);
-        QString length = QString::number(content.size());
-        QString s = "Content-Length: " + length + "\r\n\r\n";
-        QByteArray header = s.toUtf8();
-        header.append(content);
-        int written = ls->write(header);
-        if (written == -1)
-            throw "Error sending request";
-}
-
-QVector<QJsonObject> Client::getResponses() {
-    QString out = ls->readAllStandardOutput();
-    bool b = false;
-    if (!old.isEmpty()) {
-        out = old + out;
-        old.clear();
-        b = true;
-    }
-    int sz = out.size();
-    int n = 0;
-    QVector<QJsonObject> responses;
-    while (n < sz) {
-        QJsonObject o;
-        QRegularExpressionMatch match = lengthExpression.match(out, n);
-        int captured = match.capturedEnd();
-        if (captured != -1) {
-            int end = terminateExpression.match(out, captured).capturedStart();
-            if (end != -1) {
-                length = out.mid(captured, end-captured).toInt();
-                if(b){
-                    length -= 4;
-                }
-                int l2 = sz - end - 4;
-                if (length <= l2) {
-                    QString q = out.mid(end+4, length);
-                    o = QJsonDocument::fromJson(q.toUtf8()).object();
-                    if (o.empty())
-                        throw "Error parsing response";
-                    int total = length+end+4-n;
-                    n += total;
-                }
-                else if (l2 == 0)
-                    return responses;
-                else {
-                    old = out;
-                    return responses;
-                }
-            } else {
-                throw "Error parsing response";
-            }
+    sendFrame(request.contains("id") ? request.value("id").toInt() : -1, frameJson(request));
+}
+void Client::sendFrame(int id, const QByteArray &frame) {
+    if (state == State::failed || state == State::stopped)
+        return;
+    if (state != State::ready) {
+        queued.append({id, frame});
+        return;
+    }
+    writeFrame(frame);
+}
+int Client::request(const QString &method, const QJsonObject &params, QObject *owner, Callback callback) {
+    QJsonObject request = createRequest(method, params);
+    int id = request.value("id").toInt();
+    if (state == State::failed || state == State::stopped)
+        return -1;
+    pending.insert(id, {method, owner, callback, clock.nsecsElapsed(), params, QString(), 0, 0});
+    sendRequest(request);
+    return id;
+}
+// Position requests are the ones sent on every hover and keystroke, so they
+// are written from a per-method template instead of a QJsonObject.
+int Client::requestAt(const QString &method, const QString &uri, int line, int character, QObject *owner, Callback callback) {
+    if (state == State::failed || state == State::stopped)
+        return -1;
+    int id = idNumber++;
+    pending.insert(id, {method, owner, callback, clock.nsecsElapsed(), QJsonObject(), uri, line, character});
+    writeRequestAt(id, method, uri, line, character);
+    return id;
+}
+void Client::writeRequestAt(int id, const QString &method, const QString &uri, int line, int character) {
+    auto it = templates.find(method);
+    if (it == templates.end()) {
+        QByteArray prefix = ",\"method\":\"" + method.toUtf8() + "\",\"params\":{\"textDocument\":{\"uri\":";
+        it = templates.insert(method, prefix);
+    }
+    writer.clear();
+    writer.raw("{\"jsonrpc\":\"2.0\",\"id\":");
+    writer.number(id);
+    writer.raw(it.value());
+    writer.string(uri);
+    writer.raw("},\"position\":");
+    writer.position(line, character);
+    writer.raw("}}");
+    sendFrame(id, writer.frame());
+}
+void Client::sendChanges(const QString &uri, int version, const QVector<ContentChange> &changes) {
+    writer.clear();
+    writer.raw("{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didChange\",\"params\":{\"textDocument\":{\"uri\":");
+    writer.string(uri);
+    writer.raw(",\"version\":");
+    writer.number(version);
+    writer.raw("},\"contentChanges\":[");
+    for (int i = 0; i < changes.size(); i++) {
+        const ContentChange &change = changes.at(i);
+        if (i > 0)
+            writer.raw(",");
+        if (change.full) {
+            writer.raw("{\"text\":");
+        } else {
+            writer.raw("{\"range\":{\"start\":");
+            writer.position(change.startLine, change.startCharacter);
+            writer.raw(",\"end\":");
+            writer.position(change.endLine, change.endCharacter);
+            writer.raw("},\"text\":");
+        }
+        writer.string(change.text);
+        writer.raw("}");
+    }
+    writer.raw("]}}");
+    sendFrame(-1, writer.frame());
+}
+void Client::cancel(int id) {
+    if (!pending.remove(id))
+        return;
+    for (int i = 0; i < queued.size(); i++) {
+        if (queued.at(i).id == id) {
+            queued.remove(i);
+            return;
+        }
+    }
+    QJsonObject params;
+    params.insert("id", id);
+    QJsonObject cancelNotification = createNotification("$/cancelRequest", params);
+    sendRequest(cancelNotification);
+}
+
+bool Client::dispatch(const Message &response) {
+    if (response.kind != Message::Kind::response)
+        return false;
+    auto it = pending.find(response.id);
+    if (it == pending.end()) {
+        dropped++;
+        return true;
+    }
+    PendingRequest request = it.value();
+    pending.erase(it);
+    latencies[request.method].add((clock.nsecsElapsed() - request.sent) / 1000000);
+    if (request.owner && request.callback && response.object.contains("result"))
+        request.callback(response.object.value("result"));
+    return true;
+}
+
+QString Client::requestMethod(int id) const {
+    return pending.value(id).method;
+}
+
+QObject *Client::requestOwner(int id) const {
+    return pending.value(id).owner.data();
+}
+
+void Client::recordTiming(const QString &method, qint64 parse, qint64 dispatch, qint64 render) {
+    timings[method].add(parse, dispatch, render);
+}
+
+void MessageTiming::add(qint64 parse, qint64 dispatch, qint64 render) {
+    count++;
+    this->parse += parse;
+    this->dispatch += dispatch;
+    this->render += render;
+    maxDispatch = qMax(maxDispatch, dispatch);
+    maxRender = qMax(maxRender, render);
+}
+
+void LatencyHistogram::add(qint64 ms) {
+    int bucket = 0;
+    while (bucket < buckets.size() - 1 && (Q_INT64_C(1) << bucket) <= ms)
+        bucket++;
+    buckets[bucket]++;
+    count++;
+    total += ms;
+    max = qMax(max, ms);
+}
+
+QString Client::statistics() const {
+    QString s;
+    for (auto it = latencies.constBegin(); it != latencies.constEnd(); ++it) {
+        const LatencyHistogram &h = it.value();
+        s += tr("%1: %2 replies, mean %3 ms, max %4 ms\n").arg(it.key()).arg(h.count)
+                .arg(h.count ? h.total / h.count : 0).arg(h.max);
+        for (int i = 0; i < h.buckets.size(); i++) {
+            if (h.buckets.at(i) == 0)
+                continue;
+            if (i == h.buckets.size() - 1)
+                s += tr("    >= %1 ms: %2\n").arg(Q_INT64_C(1) << (i - 1)).arg(h.buckets.at(i));
+            else
+                s += tr("    < %1 ms: %2\n").arg(Q_INT64_C(1) << i).arg(h.buckets.at(i));
+        }
+    }
+    s += tr("Late replies dropped: %1\n").arg(dropped);
+    if (crashes > 0 && recoveryTime >= 0)
+        s += tr("Server restarts: %1, diagnostics last recovered after %2 ms\n").arg(crashes).arg(recoveryTime);
+    else if (crashes > 0)
+        s += tr("Server restarts: %1, diagnostics not yet recovered\n").arg(crashes);
+    for (auto it = timings.constBegin(); it != timings.constEnd(); ++it) {
+        const MessageTiming &t = it.value();
+        s += tr("%1: %2 messages, mean parse %3 us, dispatch %4 us (max %5 us), render %6 us (max %7 us)\n")
+                .arg(it.key()).arg(t.count).arg(t.parse / t.count / 1000)
+                .arg(t.dispatch / t.count / 1000).arg(t.maxDispatch / 1000)
+                .arg(t.render / t.count / 1000).arg(t.maxRender / 1000);
+    }
+    double minutes = qMax<qint64>(clock.elapsed(), 1) / 60000.0;
+    for (auto it = counters.constBegin(); it != counters.constEnd(); ++it)
+        s += tr("%1: %2 (%3 per minute)\n").arg(it.key()).arg(it.value())
+                .arg(it.value() / minutes, 0, 'f', 1);
+    return s;
+}
+
+void Client::reply(const QJsonValue &id, const QJsonValue &result) {
+    QJsonObject o;
+    o.insert("jsonrpc", "2.0");
+    o.insert("id", id);
+    o.insert("result", result);
+    write(o);
+}
+
+void Client::count(const QString &counter, int n) {
+    counters[counter] += n;
+}
+
+void Client::openDocument(const QString &uri, QObject *owner, SnapshotProvider snapshot) {
+    documents.insert(uri, {owner, snapshot});
+    sendOpen(uri, snapshot());
+}
+void Client::closeDocument(const QString &uri) {
+    documents.remove(uri);
+    QJsonObject textDocument;
+    textDocument.insert("uri", uri);
+    QJsonObject params;
+    params.insert("textDocument", textDocument);
+    sendRequest(createNotification("textDocument/didClose", params));
+}
+void Client::sendOpen(const QString &uri, const DocumentSnapshot &snapshot) {
+    QJsonObject textDocument;
+    textDocument.insert("uri", uri);
+    textDocument.insert("languageId", "rust");
+    textDocument.insert("version", snapshot.version);
+    textDocument.insert("text", snapshot.text);
+    QJsonObject params;
+    params.insert("textDocument", textDocument);
+    sendRequest(createNotification("textDocument/didOpen", params));
+}
+
+// One supervisor per workspace: a crashed server is restarted once, with
+// the delay doubling on every crash that follows shortly after a restart.
+void Client::processFinished(int exitCode, QProcess::ExitStatus exitStatus) {
+    emit finished(exitCode, exitStatus);
+    if (!keep || replaying) {
+        setState(State::stopped);
+        return;
+    }
+    this->exitCode = exitCode;
+    crashes++;
+    if (state == State::ready && startTimer.elapsed() > 60000)
+        restarts = 0;
+    if (restarts >= 8) {
+        setState(State::failed);
+        return;
+    }
+    if (!recovering) {
+        recovering = true;
+        recoveryClock.start();
+    }
+    restartDelay = qMin(500 << restarts, 30000);
+    restarts++;
+    setState(State::restarting);
+    restartTimer.start(restartDelay);
+}
+
+// Edits made while the server was down are part of the snapshots, so the
+// old queue is dropped; requests still waiting for a reply are sent again
+// under their original ids once the documents are open.
+void Client::restart() {
+    queued.clear();
+    launch();
+    for (auto it = documents.begin(); it != documents.end();) {
+        if (!it->owner) {
+            it = documents.erase(it);
+            continue;
+        }
+        sendOpen(it.key(), it->snapshot());
+        ++it;
+    }
+    if (documents.isEmpty())
+        recovering = false;
+    QList<int> ids = pending.keys();
+    std::sort(ids.begin(), ids.end());
+    for (int id: ids) {
+        const PendingRequest &request = pending[id];
+        if (!request.owner) {
+            pending.remove(id);
+            continue;
+        }
+        if (!request.uri.isEmpty()) {
+            writeRequestAt(id, request.method, request.uri, request.line, request.character);
         } else {
-            QString q = out.mid(n, length);
-            o = QJsonDocument::fromJson(q.toUtf8()).object();
-            if (o.empty())
-                throw "Error getting response";
-            int total = length;
-            n += total;
-        }
-        if (o.empty())
-            throw "Error getting response";
-        responses.push_back(o);
-    }
-    length = 0;
+            QJsonObject o;
+            o.insert("jsonrpc", "2.0");
+            o.insert("id", id);
+            o.insert("method", request.method);
+            o.insert("params", request.params);
+            sendRequest(o);
+        }
+        count("Requests re-issued after restart");
+    }
+}
+
+void Client::write(const QJsonObject &message) {
+    writeFrame(frameJson(message));
+}
+void Client::writeFrame(const QByteArray &frame) {
+    QMetaObject::invokeMethod(worker, "write", Qt::QueuedConnection, Q_ARG(QByteArray, frame));
+}
+
+QVector<Message> Client::getResponses() {
+    QVector<Message> responses;
+    responses.swap(backlog);
     return responses;
 }
 
@@ -164,3 +1061,11 @@ QJsonObject Client::createRequest(const QString &method, const QJsonObject &para
     o.insert("params", params);
     return o;
 }
+
+QJsonObject Client::createNotification(const QString &method, const QJsonObject &params) {
+    QJsonObject o;
+    o.insert("jsonrpc", "2.0");
+    o.insert("method", method);
+    o.insert("params", params);
+    return o;
+}
@@ -5,30 +5,284 @@
 #include <QJsonDocument>
 #include <QJsonArray>
 #include <QProcess>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QThread>
+#include <QFile>
+#include <QDataStream>
+#include <QPointer>
+#include <QHash>
+#include <QMap>
+#include <functional>
 #include <iostream>
 
-class Client {
+class Framer {
 public:
+    Framer();
+    char *reserve(int size);
+    void commit(int size);
+    bool next(QByteArray &message);
+private:
+    bool parseHeader();
+    QByteArray buffer;
+    int head = 0;
+    int tail = 0;
+    int scanned = 0;
+    int length = -1;
+};
+
+struct Message {
+    enum class Kind {response, notification, request};
+    static Message fromJson(const QJsonObject &object);
+    Kind kind = Kind::notification;
+    int id = -1;
+    QString method;
+    QString uri;
+    QJsonObject object;
+    qint64 parseTime = 0;
+};
+
+Q_DECLARE_METATYPE(Message)
+
+class ClientWorker : public QObject {
+    Q_OBJECT
+
+public slots:
+    void start(const QString &program, const QStringList &arguments);
+    void record(const QString &path);
+    void replay(const QString &path);
+    void write(const QByteArray &data);
+    void acknowledge();
+    void stop();
+
+signals:
+    void received(const QVector<Message> &messages);
+    void failed();
+    void finished(int exitCode, QProcess::ExitStatus exitStatus);
+    void replayFinished(int messages);
+
+private slots:
+    void readOutput();
+    void processError(QProcess::ProcessError error);
+    void replayNext();
+
+private:
+    void post(const Message &message);
+    void flush();
+    void closeProcess();
+    void store(char direction, const char *data, int size);
+    QProcess *process = nullptr;
+    Framer framer;
+    QVector<Message> outbox;
+    bool inFlight = false;
+    QFile log;
+    QDataStream logStream;
+    QElapsedTimer logClock;
+    QVector<QByteArray> records;
+    QHash<int, QPair<QString, int>> recordedIds;
+    QHash<QString, QVector<int>> liveIds;
+    int replayIndex = -1;
+    int replayed = 0;
+};
+
+class Client;
+
+class Dispatcher : public QObject {
+    Q_OBJECT
+
+public:
+    using Handler = std::function<void(const Message &message)>;
+    explicit Dispatcher(Client *client);
+    void attach(const QString &uri, QObject *owner, Handler handler);
+    void detach(const QString &uri);
+
+public slots:
+    void dispatch();
+
+private:
+    struct Subscriber {
+        QPointer<QObject> owner;
+        Handler handler;
+    };
+    Client *client;
+    QHash<QString, Subscriber> subscribers;
+};
+
+struct ContentChange {
+    bool full;
+    int startLine;
+    int startCharacter;
+    int endLine;
+    int endCharacter;
+    QString text;
+};
+
+// Serialises straight into buffers that are reused from one message to the
+// next, so hot notifications never go through QJsonObject.
+class JsonWriter {
+public:
+    JsonWriter();
+    void clear();
+    void raw(const char *text);
+    void raw(const QByteArray &text);
+    void string(const QString &text);
+    void number(qint64 n);
+    void position(int line, int character);
+    const QByteArray &frame();
+private:
+    QByteArray body;
+    QByteArray framed;
+};
+
+struct DocumentSnapshot {
+    QString text;
+    int version;
+};
+
+struct ServerBackend {
+    static ServerBackend find();
+    QString name;
+    QString program;
+    QStringList arguments;
+    bool awaitsRegistration;
+};
+
+// Until the server answers initialize everything is assumed supported;
+// messages sent before then are queued anyway.
+struct ServerCapabilities {
+    enum class Sync {none, full, incremental};
+    void parse(const QJsonObject &capabilities);
+    Sync sync = Sync::incremental;
+    bool hover = true;
+    bool completion = true;
+    bool definition = true;
+    bool semanticTokensFull = true;
+    bool semanticTokensDelta = true;
+    bool semanticTokensRange = true;
+    QStringList completionTriggers;
+    QStringList tokenTypes;
+};
+
+struct MessageTiming {
+    void add(qint64 parse, qint64 dispatch, qint64 render);
+    int count = 0;
+    qint64 parse = 0;
+    qint64 dispatch = 0;
+    qint64 render = 0;
+    qint64 maxDispatch = 0;
+    qint64 maxRender = 0;
+};
+
+struct LatencyHistogram {
+    void add(qint64 ms);
+    QVector<int> buckets = QVector<int>(14);
+    int count = 0;
+    qint64 total = 0;
+    qint64 max = 0;
+};
+
+class Client : public QObject {
+    Q_OBJECT
+
+public:
+    enum class State {stopped, starting, initializing, registering, ready, restarting, failed};
+    using Callback = std::function<void(const QJsonValue &result)>;
+    using SnapshotProvider = std::function<DocumentSnapshot()>;
     Client(QObject *parent, int pid, QString dirName);
     Client(Client&) = delete;
     ~Client();
     QJsonObject createRequest(const QString &method, const QJsonObject &params);
+    QJsonObject createNotification(const QString &method, const QJsonObject &params);
     void sendRequest(const QJsonObject &request);
+    int request(const QString &method, const QJsonObject &params, QObject *owner, Callback callback);
+    int requestAt(const QString &method, const QString &uri, int line, int character, QObject *owner, Callback callback);
+    void sendChanges(const QString &uri, int version, const QVector<ContentChange> &changes);
+    void cancel(int id);
+    void openDocument(const QString &uri, QObject *owner, SnapshotProvider snapshot);
+    void closeDocument(const QString &uri);
+    bool dispatch(const Message &response);
+    QString requestMethod(int id) const;
+    QObject *requestOwner(int id) const;
+    void recordTiming(const QString &method, qint64 parse, qint64 dispatch, qint64 render);
+    QString statistics() const;
+    void count(const QString &counter, int n = 1);
+    void reply(const QJsonValue &id, const QJsonValue &result);
     void start();
-    QVector<QJsonObject> getResponses();
-    QProcess *ls = nullptr;
+    QVector<Message> getResponses();
+    QString phase() const;
     bool keep = false;
     QString dirName;
+    ServerBackend backend;
+    ServerCapabilities capabilities;
+    State state = State::stopped;
+    bool replaying = false;
+    Dispatcher *dispatcher;
+
+signals:
+    void phaseChanged(const QString &phase);
+    void readyRead();
+    void finished(int exitCode, QProcess::ExitStatus exitStatus);
+
+private slots:
+    void receive(const QVector<Message> &messages);
+    void setReady();
+    void processFinished(int exitCode, QProcess::ExitStatus exitStatus);
+    void restart();
+
 private:
-    QObject *parent;
+    void setState(State s);
+    void launch();
+    void sendOpen(const QString &uri, const DocumentSnapshot &snapshot);
+    void writeRequestAt(int id, const QString &method, const QString &uri, int line, int character);
+    void write(const QJsonObject &message);
+    void writeFrame(const QByteArray &frame);
+    void sendFrame(int id, const QByteArray &frame);
+    struct QueuedFrame {
+        int id;
+        QByteArray frame;
+    };
+    struct PendingRequest {
+        QString method;
+        QPointer<QObject> owner;
+        Callback callback;
+        qint64 sent;
+        QJsonObject params;
+        QString uri;
+        int line;
+        int character;
+    };
+    struct OpenDocument {
+        QPointer<QObject> owner;
+        SnapshotProvider snapshot;
+    };
     int pid;
     QString rootUri;
-    QString old;
-    QRegularExpression lengthExpression;
-    QRegularExpression terminateExpression;
+    QThread thread;
+    ClientWorker *worker;
+    QVector<Message> backlog;
+    QVector<QueuedFrame> queued;
+    JsonWriter writer;
+    QHash<QString, QByteArray> templates;
+    QElapsedTimer startTimer;
+    QElapsedTimer clock;
+    QHash<int, PendingRequest> pending;
+    QMap<QString, OpenDocument> documents;
+    QMap<QString, LatencyHistogram> latencies;
+    QMap<QString, qint64> counters;
+    QMap<QString, MessageTiming> timings;
+    int dropped = 0;
+    QTimer registrationTimer;
+    qint64 readyTime = 0;
+    int initId = -1;
+    QTimer restartTimer;
+    QElapsedTimer recoveryClock;
+    bool recovering = false;
+    int restarts = 0;
+    int restartDelay = 0;
+    int exitCode = 0;
+    int crashes = 0;
+    qint64 recoveryTime = -1;
     int idNumber = 0;
-    int length = 0;
-    QVector<char> cv;
 };
 
 #endif // LSP_H
@@ -28,6 +28,9 @@
 
 #include "mainwindow.h"
 
+// Files above this size open in a read-only mapped view instead of an editor.
+static const qint64 largeFileSize = 16 << 20;
+
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
 {
@@ -53,15 +56,18 @@ MainWindow::MainWindow(QWidget *parent)
 void MainWindow::changeTab(int index) {
     setWindowTitle(tabWidget->tabText(index) + " - " + tr("Oxide"));
     if (!welcomeVisible) {
-        currentEditor = static_cast<CodeEditor*>(tabWidget->currentWidget());
-        rls = currentEditor->rls;
+        currentEditor = qobject_cast<CodeEditor*>(tabWidget->currentWidget());
+        if (currentEditor)
+            rls = currentEditor->rls;
     }
 }
 
 void MainWindow::closeTab(int index)
 {
     if (!files.isEmpty()) {
-        QString path = static_cast<CodeEditor*>(tabWidget->currentWidget())->filePath;
+        CodeEditor *editor = qobject_cast<CodeEditor*>(tabWidget->currentWidget());
+        LargeFileView *view = qobject_cast<LargeFileView*>(tabWidget->currentWidget());
+        QString path = editor ? editor->filePath : view ? view->filePath : QString();
         int idx = files.indexOf(path);
         if (idx != -1) {
             files.remove(idx);
@@ -73,7 +79,10 @@ void MainWindow::closeTab(int index)
         setWindowTitle(tr("Oxide"));
         currentEditor = nullptr;
     }
+    QWidget *widget = tabWidget->widget(index);
     tabWidget->removeTab(index);
+    if (qobject_cast<LargeFileView*>(widget))
+        widget->deleteLater();
 }
 
 void MainWindow::about()
@@ -140,7 +149,7 @@ void MainWindow::stopDebug()
     }
     if (dbStatus != Db::none) {
         dbStatus = Db::none;
-        currentEditor->stepNumber = -1;
+        currentEditor->setStepNumber(-1);
         currentEditor->update();
         applicationOutput->appendPlainText(getTime() + "Debugging ended\n");
     }
@@ -214,6 +223,21 @@ void MainWindow::loadFile(const QString &path)
     if (fileName.isNull())
         fileName = QFileDialog::getOpenFileName(this, tr("Open File"), "", "Rust Files (*.rs *.toml)");
 
+    if (!fileName.isEmpty() && QFileInfo(fileName).size() > largeFileSize) {
+        LargeFileView *view = new LargeFileView(fileName);
+        if (view->isMapped()) {
+            QFont font("Source Code Pro", 10);
+            font.setFixedPitch(true);
+            view->setFont(font);
+            files.append(fileName);
+            tabWidget->addTab(view, view->fileName);
+            tabWidget->setCurrentIndex(tabWidget->count()-1);
+            view->setFocus();
+            return;
+        }
+        delete view;
+    }
+
     if (!fileName.isEmpty()) {
         QFile file(fileName);
         QString ext = fileName.right(fileName.size() - fileName.lastIndexOf('.') - 1);
@@ -243,7 +267,11 @@ void MainWindow::loadFile(const QString &path)
                     tabWidget->removeTab(0);
                     welcomeVisible = false;
                 }
-                Client *client = new Client(parent(), QCoreApplication::applicationPid(), dirName);
+                Client *client = new Client(this, QCoreApplication::applicationPid(), dirName);
+                connect(client, &Client::phaseChanged, this, [this](const QString &phase) {
+                    statusBar()->showMessage(phase);
+                });
+                client->start();
                 clients.append(client);
                 rls = client;
                 QDir::setCurrent(dirName);
@@ -256,19 +284,10 @@ void MainWindow::loadFile(const QString &path)
             tabWidget->addTab(currentEditor, name);
             QString text = file.readAll();
             currentEditor->setPlainText(text);
-            QJsonObject params;
-            QJsonObject textDocument;
-            QString uri = "file://" + path;
-            currentEditor->uri = uri;
+            currentEditor->highlighter->lexInBackground(text);
             currentEditor->filePath = path;
             currentEditor->fileName = name;
-            textDocument.insert("uri", uri);
-            textDocument.insert("languageId", "rust");
-            textDocument.insert("version", 0);
-            textDocument.insert("text", text);
-            params.insert("textDocument", textDocument);
-            QJsonObject didOpen = rls->createRequest("textDocument/didOpen", params);
-            rls->sendRequest(didOpen);
+            currentEditor->setUri("file://" + path);
         } else {
             setupEditor();
             files.append(fileName);
@@ -276,6 +295,7 @@ void MainWindow::loadFile(const QString &path)
             tabWidget->addTab(currentEditor, name);
             QString text = file.readAll();
             currentEditor->setPlainText(text);
+            currentEditor->highlighter->lexInBackground(text);
             QFileInfo info(fileName);
             if(!file.isWritable())
                 currentEditor->setReadOnly(true);
@@ -326,6 +346,21 @@ void MainWindow::createActions()
     exitAct->setStatusTip(tr("Exit the application"));
 
 
+    QMenu *editMenu = menuBar()->addMenu(tr("&Edit"));
+    QAction *findAct = new QAction(tr("&Find..."), this);
+    findAct->setShortcuts(QKeySequence::Find);
+    findAct->setStatusTip(tr("Highlight occurrences in the current file"));
+    connect(findAct, &QAction::triggered, this, [this]() {
+        if (!currentEditor)
+            return;
+        bool ok;
+        QString text = QInputDialog::getText(this, tr("Find"), tr("Find:"), QLineEdit::Normal,
+                                             currentEditor->textCursor().selectedText(), &ok);
+        if (ok)
+            currentEditor->setSearchText(text);
+    });
+    editMenu->addAction(findAct);
+
     QMenu *buildMenu = menuBar()->addMenu(tr("&Build"));
     const QIcon buildIcon = QIcon(":/images/build.png");
     QAction *buildAct = new QAction(buildIcon, tr("Build project"), this);
@@ -387,6 +422,33 @@ void MainWindow::createActions()
     connect(toggleAct, &QAction::triggered, this, &MainWindow::breakPoint);
     debugMenu->addAction(toggleAct);
 
+    QMenu *navigateMenu = menuBar()->addMenu(tr("&Navigate"));
+    QAction *followAct = new QAction(tr("Follow symbol under cursor"), this);
+    followAct->setShortcut(QKeySequence(Qt::Key_F2));
+    connect(followAct, &QAction::triggered, this, &MainWindow::followSymbol);
+    navigateMenu->addAction(followAct);
+    QAction *enclosingAct = new QAction(tr("Go to enclosing brace"), this);
+    enclosingAct->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_BracketLeft));
+    connect(enclosingAct, &QAction::triggered, this, [this]() {
+        if (currentEditor)
+            currentEditor->gotoEnclosingBrace();
+    });
+    navigateMenu->addAction(enclosingAct);
+    QAction *nextDiagnosticAct = new QAction(tr("Next diagnostic"), this);
+    nextDiagnosticAct->setShortcut(QKeySequence(Qt::Key_F8));
+    connect(nextDiagnosticAct, &QAction::triggered, this, [this]() {
+        if (currentEditor)
+            currentEditor->nextDiagnostic();
+    });
+    navigateMenu->addAction(nextDiagnosticAct);
+    QAction *previousDiagnosticAct = new QAction(tr("Previous diagnostic"), this);
+    previousDiagnosticAct->setShortcut(QKeySequence(Qt::SHIFT + Qt::Key_F8));
+    connect(previousDiagnosticAct, &QAction::triggered, this, [this]() {
+        if (currentEditor)
+            currentEditor->previousDiagnostic();
+    });
+    navigateMenu->addAction(previousDiagnosticAct);
+
     QMenu *helpMenu = menuBar()->addMenu(tr("&Help"));
     QAction *aboutAct = helpMenu->addAction(tr("&About"), this, &MainWindow::about);
     aboutAct->setStatusTip(tr("Show the application's About box"));
@@ -394,12 +456,50 @@ void MainWindow::createActions()
 
 void MainWindow::breakPoint() {
     if (currentEditor) {
-        int bn = currentEditor->textCursor().blockNumber();
-        int index = currentEditor->breakpoints.indexOf(bn);
-        if (index != -1)
-            currentEditor->breakpoints.remove(index);
-        else
-            currentEditor->breakpoints.append(bn);
+        currentEditor->toggleBreakpoint(currentEditor->textCursor().blockNumber());
+    }
+}
+
+void MainWindow::followSymbol()
+{
+    if (currentEditor && currentEditor->rls)
+        currentEditor->followSymbol();
+}
+
+void MainWindow::openLocation(const QString &path, int line, int character)
+{
+    CodeEditor *editor = nullptr;
+    for (int i = 0; i < tabWidget->count(); i++) {
+        CodeEditor *e = qobject_cast<CodeEditor*>(tabWidget->widget(i));
+        if (e && e->filePath == path) {
+            editor = e;
+            tabWidget->setCurrentIndex(i);
+            break;
+        }
+    }
+    if (!editor) {
+        loadFile(path);
+        editor = currentEditor;
+    }
+    if (!editor || editor->filePath != path)
+        return;
+    QTextBlock block = editor->document()->findBlockByNumber(line);
+    if (!block.isValid())
+        return;
+    QTextCursor tc = editor->textCursor();
+    tc.setPosition(block.position() + qMin(character, block.length() - 1));
+    editor->setTextCursor(tc);
+    editor->centerCursor();
+}
+
+void MainWindow::showStatistics()
+{
+    if (rls) {
+        QString statistics = rls->statistics();
+        if (currentEditor)
+            statistics += tr("Decoration commits per second: %1\n").arg(currentEditor->decorations->commitsPerSecond());
+        serverOutput->appendPlainText(getTime() + rls->dirName + '\n' + statistics);
+        logs->setCurrentWidget(serverOutput);
     }
 }
 
@@ -492,7 +592,7 @@ void MainWindow::readDebugOutput()
     } else if (endExpression.match(s).capturedStart() != -1) {
         db->write("quit\n");
         dbStatus = Db::none;
-        currentEditor->stepNumber = -1;
+        currentEditor->setStepNumber(-1);
         currentEditor->update();
         applicationOutput->appendPlainText(getTime() + "Debugging ended\n");
         return;
@@ -507,9 +607,9 @@ void MainWindow::readDebugOutput()
             int colon = captured.indexOf(':');
             QStringRef name = captured.leftRef(colon);
             QStringRef num = captured.rightRef(captured.size()-colon-1);
-            currentEditor->stepNumber = num.toInt()-1;
+            currentEditor->setStepNumber(num.toInt()-1);
         } else if (nend != -1) {
-            currentEditor->stepNumber = numMatch.captured().toInt()-1;
+            currentEditor->setStepNumber(numMatch.captured().toInt()-1);
         }
         currentEditor->update();
         db->write("info locals\n");
@@ -543,7 +643,7 @@ void MainWindow::readDebugOutput()
                 int index = fileName.indexOf('/');
                 if (fileName.left(index) != "..") {
                     loadFile(fileName);
-                    currentEditor->stepNumber = list.at(1).toInt();
+                    currentEditor->setStepNumber(list.at(1).toInt());
                 } else {
                     QProcess p;
                     QStringList args(fileName.right(index));
@@ -552,7 +652,7 @@ void MainWindow::readDebugOutput()
                     QString result = p.readAllStandardOutput();
                     if (!result.isEmpty()) {
                         loadFile(result.left(result.indexOf('\n')));
-                        currentEditor->stepNumber = list.at(1).toInt();
+                        currentEditor->setStepNumber(list.at(1).toInt());
                     } else {
                         db->write("finish\n");
                         return;
@@ -582,6 +682,10 @@ void MainWindow::setupDockWindows()
     compileOutput->document()->setMaximumBlockCount(100);
     compileOutput->setReadOnly(true);
     logs->addTab(compileOutput, "Compile Output");
+    serverOutput = new QPlainTextEdit(dock);
+    serverOutput->document()->setMaximumBlockCount(1000);
+    serverOutput->setReadOnly(true);
+    logs->addTab(serverOutput, "Language Server");
     dock->setWidget(logs);
     addDockWidget(Qt::BottomDockWidgetArea, dock);
 
@@ -590,6 +694,7 @@ void MainWindow::setupDockWindows()
     QMenu *viewMenu = new QMenu(tr("&View"), this);
     menuBar()->addMenu(viewMenu);
     viewMenu->addAction(dock->toggleViewAction());
+    viewMenu->addAction(tr("Language server statistics"), this, &MainWindow::showStatistics);
 
     dirModel = new QFileSystemModel(this);
 
@@ -631,10 +736,11 @@ void MainWindow::setupEditor()
     undoGroup->addStack(currentEditor->undoStack);
     currentEditor->setFont(font);
 
-    new Highlighter(currentEditor->document());
+    currentEditor->highlighter = new Highlighter(currentEditor->document());
 
     connect(currentEditor->undoStack, &QUndoStack::indexChanged,
                 this, &MainWindow::documentWasModified);
+    connect(currentEditor, &CodeEditor::openLocation, this, &MainWindow::openLocation);
 }
 
 void MainWindow::documentWasModified()
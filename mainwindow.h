@@ -29,6 +29,7 @@
 
 #include "codeeditor.h"
 #include "highlighter.h"
+#include "largefileview.h"
 #include "nodemodel.h"
 #include "welcome.h"
 #include "wizard.h"
@@ -67,6 +68,9 @@ public slots:
     void nextLine();
     void stepOut();
     void breakPoint();
+    void followSymbol();
+    void openLocation(const QString &path, int line, int character);
+    void showStatistics();
     void readDebugOutput();
     void closeTab(int index);
     void documentWasModified();
@@ -101,6 +105,7 @@ private:
     QPlainTextEdit *issues = nullptr;
     QPlainTextEdit *applicationOutput = nullptr;
     QPlainTextEdit *compileOutput = nullptr;
+    QPlainTextEdit *serverOutput = nullptr;
     QProcess *process = nullptr;
     QProcess *db = nullptr;
     QTemporaryDir tempDir;
@@ -0,0 +1,298 @@
+/* Copyright (c) 2021, sarutora
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QVector>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <poll.h>
+#include <unistd.h>
+
+struct Options {
+    QJsonObject fixtures;
+    int split = 0;
+    int delay = 0;
+    int diagnostics = -1;
+    int completionItems = 50;
+    int crashAfter = -1;
+};
+
+class MockServer {
+public:
+    explicit MockServer(const Options &options): options(options) {
+        clock.start();
+    }
+    int run();
+
+private:
+    struct Reply {
+        qint64 due;
+        QJsonObject message;
+    };
+    bool next(QByteArray &body);
+    void handle(const QJsonObject &message);
+    void reply(const QJsonValue &id, const QJsonValue &result);
+    void publishDiagnostics(const QString &uri);
+    void send(const QJsonObject &message);
+    QJsonValue fixture(const QString &name, const QJsonValue &fallback) const;
+
+    Options options;
+    QElapsedTimer clock;
+    QByteArray input;
+    QVector<Reply> replies;
+    QVector<QJsonValue> cancelled;
+    QHash<QString, int> lineCounts;
+    int sent = 0;
+};
+
+bool MockServer::next(QByteArray &body) {
+    int end = input.indexOf("\r\n\r\n");
+    if (end == -1)
+        return false;
+    int length = -1;
+    for (const auto &line: input.left(end).split('\n')) {
+        QByteArray field = line.trimmed();
+        if (field.toLower().startsWith("content-length:"))
+            length = field.mid(15).trimmed().toInt();
+    }
+    if (length < 0) {
+        std::cerr << "mockls: missing Content-Length\n";
+        exit(2);
+    }
+    if (input.size() < end + 4 + length)
+        return false;
+    body = input.mid(end + 4, length);
+    input.remove(0, end + 4 + length);
+    return true;
+}
+
+int MockServer::run() {
+    char buffer[65536];
+    while (true) {
+        int timeout = -1;
+        if (!replies.isEmpty())
+            timeout = static_cast<int>(qMax<qint64>(0, replies.first().due - clock.elapsed()));
+        pollfd fd = {STDIN_FILENO, POLLIN, 0};
+        int ready = poll(&fd, 1, timeout);
+        if (ready > 0) {
+            ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (n <= 0)
+                return 0;
+            input.append(buffer, n);
+            QByteArray body;
+            while (next(body))
+                handle(QJsonDocument::fromJson(body).object());
+        }
+        while (!replies.isEmpty() && replies.first().due <= clock.elapsed()) {
+            QJsonObject message = replies.takeFirst().message;
+            if (!cancelled.contains(message.value("id")))
+                send(message);
+        }
+    }
+}
+
+QJsonValue MockServer::fixture(const QString &name, const QJsonValue &fallback) const {
+    return options.fixtures.contains(name) ? options.fixtures.value(name) : fallback;
+}
+
+void MockServer::handle(const QJsonObject &message) {
+    QString method = message.value("method").toString();
+    QJsonValue id = message.value("id");
+    QJsonObject params = message.value("params").toObject();
+    QJsonObject textDocument = params.value("textDocument").toObject();
+    QString uri = textDocument.value("uri").toString();
+
+    if (method == "initialize") {
+        QJsonObject capabilities;
+        capabilities.insert("textDocumentSync", 2);
+        capabilities.insert("hoverProvider", true);
+        capabilities.insert("completionProvider", QJsonObject());
+        capabilities.insert("definitionProvider", true);
+        QJsonObject result;
+        result.insert("capabilities", fixture("capabilities", capabilities));
+        reply(id, result);
+    } else if (method == "shutdown") {
+        reply(id, QJsonValue::Null);
+    } else if (method == "exit") {
+        exit(0);
+    } else if (method == "$/cancelRequest") {
+        cancelled.append(params.value("id"));
+    } else if (method == "textDocument/didOpen") {
+        lineCounts.insert(uri, textDocument.value("text").toString().count('\n') + 1);
+        publishDiagnostics(uri);
+    } else if (method == "textDocument/didChange") {
+        publishDiagnostics(uri);
+    } else if (method == "textDocument/didClose") {
+        lineCounts.remove(uri);
+    } else if (method == "textDocument/hover") {
+        QJsonObject contents;
+        contents.insert("kind", "plaintext");
+        contents.insert("value", "mock hover");
+        QJsonObject hover;
+        hover.insert("contents", contents);
+        reply(id, fixture("hover", hover));
+    } else if (method == "textDocument/completion") {
+        QJsonArray items;
+        for (int i = 0; i < options.completionItems; i++) {
+            QJsonObject item;
+            item.insert("label", QString("mock_item_%1").arg(i));
+            items.append(item);
+        }
+        QJsonObject list;
+        list.insert("isIncomplete", false);
+        list.insert("items", items);
+        reply(id, fixture("completion", list));
+    } else if (method == "textDocument/definition") {
+        QJsonObject range;
+        range.insert("start", params.value("position"));
+        range.insert("end", params.value("position"));
+        QJsonObject location;
+        location.insert("uri", uri);
+        location.insert("range", range);
+        reply(id, fixture("definition", location));
+    } else if (!id.isUndefined()) {
+        QJsonObject error;
+        error.insert("code", -32601);
+        error.insert("message", "Method not found: " + method);
+        QJsonObject response;
+        response.insert("jsonrpc", "2.0");
+        response.insert("id", id);
+        response.insert("error", error);
+        send(response);
+    }
+}
+
+void MockServer::reply(const QJsonValue &id, const QJsonValue &result) {
+    QJsonObject response;
+    response.insert("jsonrpc", "2.0");
+    response.insert("id", id);
+    response.insert("result", result);
+    if (options.delay > 0)
+        replies.append({clock.elapsed() + options.delay, response});
+    else
+        send(response);
+}
+
+void MockServer::publishDiagnostics(const QString &uri) {
+    QJsonArray diagnostics = fixture("diagnostics", QJsonArray()).toArray();
+    int count = options.diagnostics >= 0 ? options.diagnostics : diagnostics.size();
+    int lines = qMax(1, lineCounts.value(uri, 1));
+    QJsonArray published;
+    for (int i = 0; i < count; i++) {
+        if (i < diagnostics.size()) {
+            published.append(diagnostics.at(i));
+            continue;
+        }
+        QJsonObject position;
+        position.insert("line", i % lines);
+        position.insert("character", 0);
+        QJsonObject end = position;
+        end.insert("character", 1);
+        QJsonObject range;
+        range.insert("start", position);
+        range.insert("end", end);
+        QJsonObject diagnostic;
+        diagnostic.insert("range", range);
+        diagnostic.insert("severity", 1 + i % 2);
+        diagnostic.insert("message", QString("mock diagnostic %1").arg(i));
+        published.append(diagnostic);
+    }
+    QJsonObject params;
+    params.insert("uri", uri);
+    params.insert("diagnostics", published);
+    QJsonObject notification;
+    notification.insert("jsonrpc", "2.0");
+    notification.insert("method", "textDocument/publishDiagnostics");
+    notification.insert("params", params);
+    send(notification);
+}
+
+// Frames can be cut into small writes to exercise the client's framer, and
+// --crash-after ends the process halfway through a frame.
+void MockServer::send(const QJsonObject &message) {
+    QByteArray body = QJsonDocument(message).toJson(QJsonDocument::Compact);
+    QByteArray frame = "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n" + body;
+    sent++;
+    if (options.crashAfter >= 0 && sent > options.crashAfter) {
+        fwrite(frame.constData(), 1, frame.size() / 2, stdout);
+        fflush(stdout);
+        _exit(1);
+    }
+    int chunk = options.split > 0 ? options.split : frame.size();
+    for (int i = 0; i < frame.size(); i += chunk) {
+        fwrite(frame.constData() + i, 1, qMin(chunk, frame.size() - i), stdout);
+        fflush(stdout);
+        if (options.split > 0)
+            usleep(1000);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Scriptable stand-in language server for testing Oxide.");
+    parser.addHelpOption();
+    QCommandLineOption fixturesOption("fixtures", "JSON file with capabilities, hover, completion, definition and diagnostics results.", "file");
+    QCommandLineOption splitOption("split", "Write every frame in chunks of <bytes> bytes.", "bytes");
+    QCommandLineOption delayOption("delay", "Delay every reply by <ms> milliseconds.", "ms");
+    QCommandLineOption diagnosticsOption("diagnostics", "Publish <count> diagnostics on every change.", "count");
+    QCommandLineOption completionOption("completion-items", "Number of generated completion items.", "count");
+    QCommandLineOption crashOption("crash-after", "Exit in the middle of the frame after <count> messages.", "count");
+    parser.addOptions({fixturesOption, splitOption, delayOption, diagnosticsOption, completionOption, crashOption});
+    parser.process(app);
+
+    Options options;
+    if (parser.isSet(fixturesOption)) {
+        QFile file(parser.value(fixturesOption));
+        if (!file.open(QFile::ReadOnly)) {
+            std::cerr << "mockls: cannot read " << file.fileName().toStdString() << '\n';
+            return 2;
+        }
+        options.fixtures = QJsonDocument::fromJson(file.readAll()).object();
+    }
+    if (parser.isSet(splitOption))
+        options.split = parser.value(splitOption).toInt();
+    if (parser.isSet(delayOption))
+        options.delay = parser.value(delayOption).toInt();
+    if (parser.isSet(diagnosticsOption))
+        options.diagnostics = parser.value(diagnosticsOption).toInt();
+    if (parser.isSet(completionOption))
+        options.completionItems = parser.value(completionOption).toInt();
+    if (parser.isSet(crashOption))
+        options.crashAfter = parser.value(crashOption).toInt();
+
+    MockServer server(options);
+    return server.run();
+}
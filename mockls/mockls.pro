@@ -0,0 +1,9 @@
+QT       -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = mockls
+
+SOURCES += \
+    main.cpp
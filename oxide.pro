@@ -1,6 +1,6 @@
 QT       += core gui
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets concurrent
 
 CONFIG += c++11
 
@@ -9,9 +9,16 @@ CONFIG += c++11
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    bracketindex.cpp \
     codeeditor.cpp \
     commands.cpp \
+    decorations.cpp \
+    diagnosticindex.cpp \
+    fuzzymatcher.cpp \
+    gutter.cpp \
     highlighter.cpp \
+    largefileview.cpp \
+    lexer.cpp \
     lsp.cpp \
     main.cpp \
     mainwindow.cpp \
@@ -21,9 +28,16 @@ SOURCES += \
     wizard.cpp
 
 HEADERS += \
+    bracketindex.h \
     codeeditor.h \
     commands.h \
+    decorations.h \
+    diagnosticindex.h \
+    fuzzymatcher.h \
+    gutter.h \
     highlighter.h \
+    largefileview.h \
+    lexer.h \
     lsp.h \
     mainwindow.h \
     node.h \